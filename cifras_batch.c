@@ -0,0 +1,629 @@
+#include "cifras_batch.h"
+#include "cifras_bt.h"
+#include "cifras_dp.h"
+#include "cifras_parse.h"
+#include "work_pool.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Input bytes of a chunk, the task of a worker. Chunks end at a new-line, so
+// they are a bit longer
+#define BATCH_CHUNK_BYTES (16 << 10)
+// Chunks solved and written at a time. It bounds the memory used regardless
+// of the size of the input (and it is below IOV_MAX)
+#define BATCH_ROUND_CHUNKS 256
+// Input bytes of a round
+#define BATCH_ROUND_BYTES ((size_t)BATCH_CHUNK_BYTES * BATCH_ROUND_CHUNKS)
+// Games parsed, solved and formatted at a time by a worker. Games are only
+// solved together (resolve_cifras_batch) within a block
+#define BATCH_SOLVE_GAMES 1024
+// Parse a whole game with cifras_parse_values: MIN_NUM_COUNT to
+// MAX_NUM_COUNT numbers and a target (the last value). [begin, end) must not
+// contain the new-line
+void batch_parse_game(const char* begin, const char* end, bool wide,
+	BatchGame* game)
+	{
+	long int values[MAX_NUM_COUNT + 1];
+	long int max_number = wide ? WIDE_MAX_NUMBER : MAX_NUMBER;
+	long int min_target = wide ? WIDE_MIN_TARGET : MIN_TARGET;
+	long int max_target = wide ? WIDE_MAX_TARGET : MAX_TARGET;
+	int count, i;
+
+	game->error = NULL;
+	game->error_value = -1;
+
+	// Values of more than CIFRAS_PARSE_MAX_DIGITS digits are a format error
+	if (cifras_parse_values(begin, end, values, MAX_NUM_COUNT + 1, &count) != 0 ||
+		count < MIN_NUM_COUNT + 1)
+		{
+		game->error = "wrong format";
+		return;
+		}
+
+	game->numbers_count = count - 1;
+	for (i = 0; i < game->numbers_count; i++)
+		{
+		if (values[i] < MIN_NUMBER || values[i] > max_number)
+			{
+			game->error = "number out of range";
+			game->error_value = values[i];
+			return;
+			}
+		game->numbers[i] = values[i];
+		}
+	if (values[count - 1] < min_target || values[count - 1] > max_target)
+		{
+		game->error = "target out of range";
+		game->error_value = values[count - 1];
+		return;
+		}
+	game->target = (int)values[count - 1];
+	}
+
+void batch_solve_game(BatchGame* game, const BatchConfig* config)
+	{
+	if (game->error != NULL)
+		return;
+	// The db only covers classic games of NUM_COUNT numbers
+	if (config->db != NULL && game->numbers_count == NUM_COUNT &&
+		cifras_db_lookup(config->db, game->numbers, game->target, &game->steps))
+		return;
+	resolve_cifras_cached(config->cache, game->numbers, game->numbers_count,
+		game->target, &game->steps, config->engine);
+	}
+
+// Write value in decimal at line. Return its length
+static inline int format_long(char* line, long int value)
+	{
+	char digits[20];
+	unsigned long int magnitude;
+	int count = 0, length = 0;
+
+	magnitude = value < 0 ? -(unsigned long int)value : (unsigned long int)value;
+	do
+		{
+		digits[count++] = (char)('0' + magnitude % 10);
+		magnitude /= 10;
+		}
+	while (magnitude != 0);
+	if (value < 0)
+		line[length++] = '-';
+	while (count > 0)
+		line[length++] = digits[--count];
+	return length;
+	}
+
+int batch_format_game(const BatchGame* game, char* line)
+	{
+	const SolutionStep* step;
+	long int result;
+	int i, length;
+
+	if (game->error != NULL)
+		{
+		if (game->error_value < 0)
+			return snprintf(line, BATCH_MAX_LINE, "error: %s\n", game->error);
+		return snprintf(line, BATCH_MAX_LINE, "error: %s (%ld)\n", game->error,
+			game->error_value);
+		}
+
+	assert(steps_stack_is_empty(&game->steps) == false);
+	result = steps_stack_result(&game->steps);
+	// Every value has 19 digits at most (long int), so the longest line
+	// (MAX_SOLUTION_STEPS steps) fits in BATCH_MAX_LINE
+	// Same as "%ld %+ld" and " %ld%c%ld=%ld" per step, without the cost of
+	// sprintf, which dominates when printing millions of lines
+	length = format_long(line, result);
+	line[length++] = ' ';
+	if (result >= (long int)game->target)
+		line[length++] = '+';
+	length += format_long(line + length, result - (long int)game->target);
+	for (i = 0; i < steps_stack_count(&game->steps); i++)
+		{
+		step = &game->steps.steps[i];
+		line[length++] = ' ';
+		length += format_long(line + length, step->a);
+		line[length++] = step->op;
+		length += format_long(line + length, step->b);
+		line[length++] = '=';
+		length += format_long(line + length, step->result);
+		}
+	line[length++] = '\n';
+	line[length] = '\0';
+	assert(length < BATCH_MAX_LINE);
+	return length;
+	}
+
+// Game of a batch and its numbers packed one per byte in their order (the
+// key of the group), or 0 if it cannot be solved by resolve_cifras_dp_targets
+typedef struct
+	{
+	uint64_t numbers;
+	size_t index;
+	} BatchKey;
+
+static uint64_t batch_key_numbers(const CifrasGame* game)
+	{
+	uint64_t numbers = 0;
+	int i;
+
+	// With more numbers, building every value costs much more than the
+	// searches of a few targets, which stop once they reach the target
+	if (game->numbers_count != NUM_COUNT ||
+		game->target < MIN_TARGET || game->target > MAX_TARGET)
+		return 0;
+	for (i = 0; i < game->numbers_count; i++)
+		{
+		if (game->numbers[i] < MIN_NUMBER || game->numbers[i] > MAX_NUMBER)
+			return 0;
+		numbers |= (uint64_t)game->numbers[i] << (8 * i);
+		}
+	return numbers;
+	}
+
+static int batch_key_compare(const void* a, const void* b)
+	{
+	const BatchKey* key1 = a;
+	const BatchKey* key2 = b;
+
+	if (key1->numbers != key2->numbers)
+		return key1->numbers < key2->numbers ? -1 : 1;
+	return (key1->index > key2->index) - (key1->index < key2->index);
+	}
+
+// Solve the games [first, last) of keys, which share their numbers, with a
+// single resolve_cifras_dp_targets. Return false if it cannot
+static bool batch_solve_group(const CifrasGame* games,
+	SolutionStepStack* results, const BatchKey* keys, size_t first, size_t last)
+	{
+	SolutionStepStack* steps;
+	int* targets;
+	size_t k;
+	bool solved;
+
+	targets = malloc(sizeof(int) * (last - first));
+	steps = malloc(sizeof(SolutionStepStack) * (last - first));
+	solved = targets != NULL && steps != NULL;
+	if (solved)
+		{
+		for (k = first; k < last; k++)
+			targets[k - first] = games[keys[k].index].target;
+		solved = resolve_cifras_dp_targets(games[keys[first].index].numbers,
+			games[keys[first].index].numbers_count, targets, last - first,
+			steps) == 0;
+		}
+	if (solved)
+		for (k = first; k < last; k++)
+			steps_stack_copy(&results[keys[k].index], &steps[k - first]);
+	free(targets);
+	free(steps);
+	return solved;
+	}
+
+void resolve_cifras_batch(const CifrasGame* games, size_t count,
+	SolutionStepStack* results)
+	{
+	BatchKey* keys;
+	size_t first, last, k;
+
+	assert(games != NULL || count == 0);
+	assert(results != NULL || count == 0);
+
+	keys = malloc(sizeof(BatchKey) * count);
+	if (keys == NULL)
+		{
+		for (k = 0; k < count; k++)
+			resolve_cifras_engine(games[k].numbers, games[k].numbers_count,
+				games[k].target, &results[k], CIFRAS_ENGINE_AUTO);
+		return;
+		}
+
+	// Games of the same numbers together
+	for (k = 0; k < count; k++)
+		keys[k] = (BatchKey){batch_key_numbers(&games[k]), k};
+	qsort(keys, count, sizeof(BatchKey), batch_key_compare);
+
+	for (first = 0; first < count; first = last)
+		{
+		for (last = first + 1; last < count &&
+			keys[last].numbers == keys[first].numbers; last++)
+			;
+		if (keys[first].numbers != 0 &&
+			last - first >= CIFRAS_BATCH_GROUP_GAMES &&
+			batch_solve_group(games, results, keys, first, last))
+			continue;
+		for (k = first; k < last; k++)
+			resolve_cifras_engine(games[keys[k].index].numbers,
+				games[keys[k].index].numbers_count, games[keys[k].index].target,
+				&results[keys[k].index], CIFRAS_ENGINE_AUTO);
+		}
+	free(keys);
+	}
+
+// Per-worker state of batch_run, so blocks are solved without allocations
+typedef struct
+	{
+	BatchGame games[BATCH_SOLVE_GAMES];
+	// Games parsed correctly, their index in games and their solutions, for
+	// resolve_cifras_batch
+	CifrasGame batch_games[BATCH_SOLVE_GAMES];
+	size_t batch_index[BATCH_SOLVE_GAMES];
+	SolutionStepStack batch_results[BATCH_SOLVE_GAMES];
+	} BatchWorker;
+
+// Solve the count games of the block of worker with resolve_cifras_batch
+static void batch_solve_games(BatchWorker* worker, size_t count)
+	{
+	BatchGame* game;
+	size_t batch_count = 0, i;
+
+	for (i = 0; i < count; i++)
+		{
+		game = &worker->games[i];
+		if (game->error != NULL)
+			continue;
+		memcpy(worker->batch_games[batch_count].numbers, game->numbers,
+			sizeof(long int) * game->numbers_count);
+		worker->batch_games[batch_count].numbers_count = game->numbers_count;
+		worker->batch_games[batch_count].target = game->target;
+		worker->batch_index[batch_count++] = i;
+		}
+	resolve_cifras_batch(worker->batch_games, batch_count,
+		worker->batch_results);
+	for (i = 0; i < batch_count; i++)
+		steps_stack_copy(&worker->games[worker->batch_index[i]].steps,
+			&worker->batch_results[i]);
+	}
+
+// Lines [begin, end) of the input and their output lines
+typedef struct
+	{
+	const char* begin;
+	const char* end;
+	// Kept from round to round, so it only grows a few times
+	char* output;
+	size_t output_length;
+	size_t output_size;
+	// Out of memory for the output
+	bool failed;
+	} BatchChunk;
+
+typedef struct
+	{
+	BatchChunk* chunks;
+	// One per worker of work_pool_run
+	BatchWorker* workers;
+	const BatchConfig* config;
+	} BatchJob;
+
+// Solve and format the count games of the block of worker into chunk.
+// Return false if out of memory
+static bool batch_flush_block(BatchJob* job, BatchWorker* worker,
+	size_t count, BatchChunk* chunk)
+	{
+	const BatchConfig* config = job->config;
+	size_t size, i;
+	char* output;
+
+	if (config->engine == CIFRAS_ENGINE_AUTO && config->db == NULL &&
+		config->cache == NULL)
+		batch_solve_games(worker, count);
+	else
+		for (i = 0; i < count; i++)
+			batch_solve_game(&worker->games[i], config);
+
+	for (i = 0; i < count; i++)
+		{
+		if (chunk->output_size - chunk->output_length < BATCH_MAX_LINE)
+			{
+			size = chunk->output_size * 2 + BATCH_MAX_LINE;
+			output = realloc(chunk->output, size);
+			if (output == NULL)
+				return false;
+			chunk->output = output;
+			chunk->output_size = size;
+			}
+		chunk->output_length += batch_format_game(&worker->games[i],
+			chunk->output + chunk->output_length);
+		}
+	return true;
+	}
+
+// Parse, solve and format every game of a chunk, a block at a time. The lines
+// are parsed in place and the output lines are written straight into the
+// chunk buffer
+static void solve_chunk(void* arg, size_t task_index, int worker_id)
+	{
+	BatchJob* job = arg;
+	BatchChunk* chunk = &job->chunks[task_index];
+	BatchWorker* worker = &job->workers[worker_id];
+	const char* line;
+	const char* line_end;
+	const char* p;
+	size_t count = 0;
+
+	chunk->output_length = 0;
+	chunk->failed = false;
+	for (line = chunk->begin; line < chunk->end; line = line_end + 1)
+		{
+		line_end = memchr(line, '\n', chunk->end - line);
+		if (line_end == NULL)
+			line_end = chunk->end;
+		// Blank lines are skipped
+		for (p = line; p < line_end && cifras_parse_is_blank(*p); p++)
+			;
+		if (p == line_end)
+			continue;
+
+		batch_parse_game(line, line_end, job->config->wide,
+			&worker->games[count++]);
+		if (count == BATCH_SOLVE_GAMES)
+			{
+			if (batch_flush_block(job, worker, count, chunk) == false)
+				{
+				chunk->failed = true;
+				return;
+				}
+			count = 0;
+			}
+		}
+	if (count > 0 && batch_flush_block(job, worker, count, chunk) == false)
+		chunk->failed = true;
+	}
+
+// writev every buffer of iov, in order, retrying short writes.
+// Return values:
+// 0: all written
+// 1: error (errno set)
+static int write_all(int fd, struct iovec* iov, int count)
+	{
+	ssize_t written;
+
+	while (count > 0)
+		{
+		written = writev(fd, iov, count);
+		if (written < 0)
+			{
+			if (errno == EINTR)
+				continue;
+			return 1;
+			}
+		for (; count > 0 && (size_t)written >= iov->iov_len; iov++, count--)
+			written -= iov->iov_len;
+		if (count > 0)
+			{
+			iov->iov_base = (char*)iov->iov_base + written;
+			iov->iov_len -= written;
+			}
+		}
+	return 0;
+	}
+
+// Split the whole lines [begin, end) into chunks, solve them in parallel and
+// write their output in order.
+// Return values:
+// 0: round written
+// 1: error
+static int batch_round(const char* begin, const char* end, BatchJob* job,
+	int nthreads, int fd)
+	{
+	struct iovec iov[BATCH_ROUND_CHUNKS];
+	const char* chunk_end;
+	size_t count, i;
+
+	for (count = 0; begin < end; count++, begin = chunk_end)
+		{
+		assert(count < BATCH_ROUND_CHUNKS);
+		chunk_end = begin + BATCH_CHUNK_BYTES;
+		if (count == BATCH_ROUND_CHUNKS - 1 || chunk_end >= end)
+			chunk_end = end;
+		else
+			{
+			chunk_end = memchr(chunk_end, '\n', end - chunk_end);
+			chunk_end = chunk_end != NULL ? chunk_end + 1 : end;
+			}
+		job->chunks[count].begin = begin;
+		job->chunks[count].end = chunk_end;
+		}
+
+	if (work_pool_run(count, nthreads, solve_chunk, job) != 0)
+		for (i = 0; i < count; i++)
+			solve_chunk(job, i, 0);
+
+	for (i = 0; i < count; i++)
+		{
+		if (job->chunks[i].failed)
+			{
+			fprintf(stderr, "Error in batch_run: out of memory\n");
+			return 1;
+			}
+		iov[i].iov_base = job->chunks[i].output;
+		iov[i].iov_len = job->chunks[i].output_length;
+		}
+	if (write_all(fd, iov, (int)count) != 0)
+		{
+		perror("Error in batch_run: writev");
+		return 1;
+		}
+	return 0;
+	}
+
+// Input which is not a regular file (a pipe, a terminal...): read into a
+// buffer and run a round over its whole lines. The tail of an incomplete line
+// is moved to the front for the next round
+static int batch_read_rounds(int input_fd, BatchJob* job, int nthreads,
+	int output_fd)
+	{
+	char* buffer;
+	char* bigger;
+	size_t size = BATCH_ROUND_BYTES, length = 0, lines;
+	ssize_t bytes = 1;
+	int ret = 0;
+
+	buffer = malloc(size);
+	if (buffer == NULL)
+		{
+		fprintf(stderr, "Error in batch_run: out of memory\n");
+		return 1;
+		}
+	while (bytes > 0 && ret == 0)
+		{
+		// Fill the buffer up
+		while (length < size)
+			{
+			bytes = read(input_fd, buffer + length, size - length);
+			if (bytes < 0 && errno == EINTR)
+				continue;
+			if (bytes <= 0)
+				break;
+			length += bytes;
+			}
+		if (bytes < 0)
+			{
+			perror("Error in batch_run: read");
+			ret = 1;
+			break;
+			}
+
+		// Whole lines only, unless the input is over
+		if (bytes == 0)
+			lines = length;
+		else
+			{
+			for (lines = length; lines > 0 && buffer[lines - 1] != '\n'; lines--)
+				;
+			}
+		if (lines == 0 && bytes != 0)
+			{
+			// A line longer than the buffer
+			bigger = realloc(buffer, size * 2);
+			if (bigger == NULL)
+				{
+				fprintf(stderr, "Error in batch_run: out of memory\n");
+				ret = 1;
+				break;
+				}
+			buffer = bigger;
+			size *= 2;
+			continue;
+			}
+		ret = batch_round(buffer, buffer + lines, job, nthreads, output_fd);
+		memmove(buffer, buffer + lines, length - lines);
+		length -= lines;
+		}
+	free(buffer);
+	return ret;
+	}
+
+int batch_run(const char* input_path, FILE* output, int nthreads,
+	const BatchConfig* config)
+	{
+	BatchChunk* chunks;
+	BatchWorker* workers;
+	BatchJob job;
+	struct stat st;
+	const char* map = NULL;
+	const char* begin;
+	const char* end;
+	const char* round_end;
+	off_t offset = 0;
+	int input_fd, output_fd, ret = 0, i;
+
+	assert(input_path != NULL);
+	assert(output != NULL);
+	assert(config != NULL);
+
+	if (strcmp(input_path, "-") == 0)
+		input_fd = STDIN_FILENO;
+	else
+		{
+		input_fd = open(input_path, O_RDONLY);
+		if (input_fd < 0)
+			{
+			perror("Error in batch_run: open");
+			return 1;
+			}
+		}
+
+	// work_pool_run never uses more workers than nthreads
+	if (nthreads <= 0)
+		nthreads = work_pool_default_threads();
+	chunks = calloc(BATCH_ROUND_CHUNKS, sizeof(BatchChunk));
+	workers = calloc(nthreads, sizeof(BatchWorker));
+	if (chunks == NULL || workers == NULL)
+		{
+		fprintf(stderr, "Error in batch_run: out of memory\n");
+		free(chunks);
+		free(workers);
+		if (input_fd != STDIN_FILENO)
+			close(input_fd);
+		return 1;
+		}
+	job = (BatchJob){chunks, workers, config};
+	// The output goes straight to the file descriptor from now on
+	if (fflush(output) != 0)
+		{
+		perror("Error in batch_run: fflush");
+		ret = 1;
+		}
+	output_fd = fileno(output);
+
+	// A regular file (stdin too if redirected from one) is mapped and its
+	// lines parsed in place, from the current offset
+	if (ret == 0 && fstat(input_fd, &st) == 0 && S_ISREG(st.st_mode))
+		{
+		offset = lseek(input_fd, 0, SEEK_CUR);
+		if (offset < 0 || offset > st.st_size)
+			offset = 0;
+		if (st.st_size > offset)
+			{
+			map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, input_fd, 0);
+			if (map == MAP_FAILED)
+				map = NULL;
+			}
+		}
+
+	if (ret != 0)
+		;
+	else if (map != NULL)
+		{
+		// Read once, from the beginning to the end
+		madvise((void*)map, st.st_size, MADV_SEQUENTIAL);
+		end = map + st.st_size;
+		for (begin = map + offset; begin < end && ret == 0; begin = round_end)
+			{
+			round_end = begin + BATCH_ROUND_BYTES;
+			if (round_end >= end)
+				round_end = end;
+			else
+				{
+				round_end = memchr(round_end, '\n', end - round_end);
+				round_end = round_end != NULL ? round_end + 1 : end;
+				}
+			ret = batch_round(begin, round_end, &job, nthreads, output_fd);
+			}
+		munmap((void*)map, st.st_size);
+		}
+	// Not a regular file (or empty)
+	else
+		ret = batch_read_rounds(input_fd, &job, nthreads, output_fd);
+
+	for (i = 0; i < BATCH_ROUND_CHUNKS; i++)
+		free(chunks[i].output);
+	free(chunks);
+	free(workers);
+	if (input_fd != STDIN_FILENO)
+		close(input_fd);
+	return ret;
+	}
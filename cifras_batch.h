@@ -0,0 +1,104 @@
+#ifndef CIFRAS_BATCH_H
+#define CIFRAS_BATCH_H
+
+#include "cifras_cache.h"
+#include "cifras_db.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// One game of the input and its solution
+typedef struct
+	{
+	long int numbers[MAX_NUM_COUNT];
+	int numbers_count;
+	int target;
+	// NULL if the line was parsed correctly
+	const char* error;
+	// Value out of range which caused the error or -1 if none
+	long int error_value;
+	SolutionStepStack steps;
+	} BatchGame;
+
+// How the games of batch_run and serve_run are parsed and solved
+typedef struct
+	{
+	// Precomputed solutions (cifras_db_lookup) or NULL
+	const CifrasDb* db;
+	// Cache of the solutions of the games out of the db (cifras_cache.h) or
+	// NULL
+	CifrasCache* cache;
+	// Search engine of the games out of the db and the cache
+	CifrasEngine engine;
+	// Wide games: numbers up to WIDE_MAX_NUMBER and targets from
+	// WIDE_MIN_TARGET to WIDE_MAX_TARGET instead of the classic ranges
+	bool wide;
+	} BatchConfig;
+
+// Longest output line of a game, new-line and terminating null included
+#define BATCH_MAX_LINE 512
+
+// Parse the line [begin, end), without the new-line, into game. game->error
+// tells why if the line is wrong. wide: ranges of BatchConfig.wide
+void batch_parse_game(const char* begin, const char* end, bool wide,
+	BatchGame* game);
+// Solve a game parsed correctly (nothing otherwise)
+void batch_solve_game(BatchGame* game, const BatchConfig* config);
+// Write the output line of game (see batch_run) into line, which must hold
+// BATCH_MAX_LINE chars. Return its length
+int batch_format_game(const BatchGame* game, char* line);
+
+// A game of resolve_cifras_batch
+typedef struct
+	{
+	long int numbers[MAX_NUM_COUNT];
+	int numbers_count;
+	int target;
+	} CifrasGame;
+
+// Solve count games into results[0..count-1], faster per game than
+// resolve_cifras_engine with CIFRAS_ENGINE_AUTO in a loop and with the same
+// steps for every game, whatever the other games of the batch: the classic
+// games (NUM_COUNT numbers) which have the same numbers in the same order as
+// at least CIFRAS_BATCH_GROUP_GAMES - 1 others are all answered by a single
+// build of the values of their numbers (resolve_cifras_dp_targets).
+// Single-threaded
+void resolve_cifras_batch(const CifrasGame* games, size_t count,
+	SolutionStepStack* results);
+#define CIFRAS_BATCH_GROUP_GAMES 4
+
+// Non-interactive mode.
+//
+// Every non-empty line of the input is a game: MIN_NUM_COUNT to MAX_NUM_COUNT
+// numbers followed by the target, separated with spaces or commas. For
+// example:
+// 10 50 5 50 6 25 988
+//
+// For every game one line is written in the same order as the input:
+// <result> <diff> <steps...>
+// where diff is result - target with sign and every step is written as
+// a<op>b=result. For example:
+// 988 +0 10*50=500 500-6=494 494*50=24700 24700/25=988
+// (with the default bt engine; with CIFRAS_ENGINE_AUTO the same game gives
+// 988 +0 10/5=2 2+50=52 25-6=19 52*19=988)
+//
+// A line which cannot be parsed produces the line:
+// error: <reason>
+//
+// The input is split into chunks of whole lines, which are parsed, solved
+// and formatted in parallel, one chunk per task, into an output buffer per
+// chunk. The buffers are written in the input order with writev, straight to
+// the file descriptor of output (flushed first). A regular file is mapped
+// with mmap and its lines parsed in place; other inputs (pipes) are read into
+// a buffer of whole lines. With CIFRAS_ENGINE_AUTO and no db or cache, the
+// games of a chunk are solved together by resolve_cifras_batch.
+// input_path: file to read or "-" for stdin.
+// nthreads <= 0 means one thread per online CPU.
+//
+// Return values:
+// 0: all the lines processed (even if some of them were wrong)
+// 1: I/O error
+int batch_run(const char* input_path, FILE* output, int nthreads,
+	const BatchConfig* config);
+
+#endif
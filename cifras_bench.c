@@ -0,0 +1,417 @@
+// Benchmark of resolve_cifras over a fixed corpus.
+//
+// Usage: cifras_bench [--csv|--json] [--games N] [--seed S] [--repeat R]
+//                     [--numbers C] [--engine bt|dp|id|iter|auto]
+//                     [--bounds LIST] [--parse]
+//
+// LIST: bounds of the bt engine separated with commas (length, upper, steps,
+// depth), "default" (CIFRAS_BOUNDS_DEFAULT), "all" or "none"
+//
+// Corpus groups:
+// - random: N games of C numbers (NUM_COUNT by default) generated like
+// cifras_random_numbers (cifras_gen.h) with a fixed seed (own copy of the
+// PRNG, so the corpus does not change with the generator)
+// - hard: worst-case games with unreachable targets, run R times each (only
+// for games of NUM_COUNT numbers)
+//
+// For every group, one row with games/sec, latency per game (p50, p99, max)
+// and nodes visited per game (only counted by the bt, id and iter engines).
+// Build with -DCIFRAS_STATS (make bench)
+//
+// --parse benchmarks the input parser (cifras_parse.h) instead of the
+// solver: the random games are written as text lines, repeated up to
+// BENCH_PARSE_BYTES, and parsed R times. One row with MB/sec and lines/sec
+// is written.
+
+#include "cifras_bt.h"
+#include "cifras_parse.h"
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_DEFAULT_GAMES 2000
+#define BENCH_DEFAULT_SEED 20240101
+#define BENCH_DEFAULT_REPEAT 5
+// Size of the text parsed by --parse
+#define BENCH_PARSE_BYTES (64 << 20)
+// Same distribution as cifras_random_numbers (cifras_gen.h)
+#define BENCH_BIG_NUMBER_PROBABILITY 28
+
+typedef struct
+	{
+	long int numbers[MAX_NUM_COUNT];
+	int numbers_count;
+	int target;
+	} BenchGame;
+
+typedef struct
+	{
+	double elapsed_ns;
+	unsigned long long nodes;
+	} BenchSample;
+
+typedef enum {FORMAT_CSV, FORMAT_JSON} BenchFormat;
+
+static const long int BENCH_BIG_NUMBERS[] = {10, 25, 50, 100};
+
+// Unreachable targets found with cifras_reachable_all
+static const BenchGame HARD_GAMES[] =
+	{
+	{{100, 100, 100, 25, 10, 9}, NUM_COUNT, 121},
+	{{100, 100, 100, 25, 10, 9}, NUM_COUNT, 163},
+	{{100, 100, 100, 25, 10, 9}, NUM_COUNT, 178},
+	{{100, 50, 25, 10, 9, 8}, NUM_COUNT, 881},
+	{{100, 50, 25, 10, 9, 8}, NUM_COUNT, 919},
+	{{100, 50, 25, 10, 9, 8}, NUM_COUNT, 956},
+	{{100, 75, 50, 25, 10, 1}, NUM_COUNT, 416},
+	{{100, 75, 50, 25, 10, 1}, NUM_COUNT, 478},
+	{{100, 75, 50, 25, 10, 1}, NUM_COUNT, 556},
+	{{9, 9, 8, 8, 7, 7}, NUM_COUNT, 164},
+	{{9, 9, 8, 8, 7, 7}, NUM_COUNT, 235},
+	{{9, 9, 8, 8, 7, 7}, NUM_COUNT, 267},
+	{{25, 50, 75, 100, 3, 6}, NUM_COUNT, 340},
+	{{25, 50, 75, 100, 3, 6}, NUM_COUNT, 683},
+	{{25, 50, 75, 100, 3, 6}, NUM_COUNT, 715},
+	};
+static const size_t HARD_GAMES_COUNT = sizeof(HARD_GAMES) / sizeof(HARD_GAMES[0]);
+
+// xorshift64*
+static uint64_t bench_random(uint64_t* state)
+	{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1DULL;
+	}
+
+static int bench_random_natural(uint64_t* state, int min_val, int max_val)
+	{
+	return min_val + (int)(bench_random(state) % (uint64_t)(max_val - min_val + 1));
+	}
+
+static void generate_corpus(BenchGame* games, size_t count,
+	int numbers_count, uint64_t seed)
+	{
+	uint64_t state = seed != 0 ? seed : 1;
+	size_t g;
+	int i;
+
+	for (g = 0; g < count; g++)
+		{
+		games[g].numbers_count = numbers_count;
+		for (i = 0; i < numbers_count; i++)
+			if (bench_random_natural(&state, 0, 100) <= BENCH_BIG_NUMBER_PROBABILITY)
+				games[g].numbers[i] = BENCH_BIG_NUMBERS[bench_random_natural(&state,
+					0, sizeof(BENCH_BIG_NUMBERS) / sizeof(BENCH_BIG_NUMBERS[0]) - 1)];
+			else
+				games[g].numbers[i] = bench_random_natural(&state, 1, 9);
+		games[g].target = bench_random_natural(&state, MIN_TARGET, MAX_TARGET);
+		}
+	}
+
+static double now_ns(void)
+	{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+	}
+
+static int compare_doubles(const void* a, const void* b)
+	{
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+	}
+
+static void run_game(const BenchGame* game, CifrasEngine engine,
+	unsigned bounds, BenchSample* sample)
+	{
+	SolutionStepStack best_steps;
+	SearchStats stats;
+	CifrasSearch search;
+	double start;
+	int depth;
+
+	sample->nodes = 0;
+	if (engine == CIFRAS_ENGINE_DP || engine == CIFRAS_ENGINE_AUTO)
+		{
+		start = now_ns();
+		resolve_cifras_engine(game->numbers, game->numbers_count, game->target,
+			&best_steps, engine);
+		sample->elapsed_ns = now_ns() - start;
+		return;
+		}
+	// The resumable search counts its own nodes
+	if (engine == CIFRAS_ENGINE_ITER)
+		{
+		start = now_ns();
+		cifras_search_init(&search, game->numbers, game->numbers_count,
+			game->target);
+		cifras_search_run(&search, ULLONG_MAX);
+		sample->elapsed_ns = now_ns() - start;
+		sample->nodes = search.nodes;
+		return;
+		}
+
+	// Latency without the cost of updating the counters
+	start = now_ns();
+	if (engine == CIFRAS_ENGINE_ID)
+		resolve_cifras_deepening(game->numbers, game->numbers_count,
+			game->target, &best_steps, NULL);
+	else
+		resolve_cifras_bounds(game->numbers, game->numbers_count, game->target,
+			&best_steps, bounds, NULL);
+	sample->elapsed_ns = now_ns() - start;
+
+	if (engine == CIFRAS_ENGINE_ID)
+		resolve_cifras_deepening(game->numbers, game->numbers_count,
+			game->target, &best_steps, &stats);
+	else
+		resolve_cifras_bounds(game->numbers, game->numbers_count, game->target,
+			&best_steps, bounds, &stats);
+	for (depth = 0; depth < MAX_NUM_COUNT; depth++)
+		sample->nodes += stats.nodes[depth];
+	}
+
+// Return false if list has an unknown bound
+static bool parse_bounds(const char* list, unsigned* bounds)
+	{
+	static const struct
+		{
+		const char* name;
+		unsigned bound;
+		} BOUND_NAMES[] =
+		{
+		{"default", CIFRAS_BOUNDS_DEFAULT},
+		{"all", CIFRAS_BOUNDS_ALL},
+		{"none", 0},
+		{"length", CIFRAS_BOUND_LENGTH},
+		{"upper", CIFRAS_BOUND_UPPER_VALUE},
+		{"steps", CIFRAS_BOUND_STEP_COUNT},
+		{"depth", CIFRAS_BOUND_DEPTH_VALUE},
+		};
+	const char* end;
+	size_t length, i;
+
+	*bounds = 0;
+	for (; *list != '\0'; list = *end == ',' ? end + 1 : end)
+		{
+		end = strchr(list, ',');
+		if (end == NULL)
+			end = list + strlen(list);
+		length = (size_t)(end - list);
+		for (i = 0; i < sizeof(BOUND_NAMES) / sizeof(BOUND_NAMES[0]); i++)
+			if (strlen(BOUND_NAMES[i].name) == length &&
+				strncmp(BOUND_NAMES[i].name, list, length) == 0)
+				break;
+		if (i == sizeof(BOUND_NAMES) / sizeof(BOUND_NAMES[0]))
+			return false;
+		*bounds |= BOUND_NAMES[i].bound;
+		}
+	return true;
+	}
+
+// Parse the games written as text lines (see --parse). Return 1 if out of
+// memory
+static int run_parse(const BenchGame* games, size_t count, int repeat,
+	BenchFormat format)
+	{
+	long int values[MAX_NUM_COUNT + 1];
+	char* text;
+	const char* line;
+	const char* end;
+	size_t size = 0, lines = 0, g;
+	double start, seconds;
+	int r, i, parsed, errors = 0;
+
+	text = malloc(BENCH_PARSE_BYTES + 128);
+	if (text == NULL)
+		return 1;
+	for (g = 0; size < BENCH_PARSE_BYTES; g = (g + 1) % count, lines++)
+		{
+		for (i = 0; i < games[g].numbers_count; i++)
+			size += sprintf(text + size, "%ld ", games[g].numbers[i]);
+		size += sprintf(text + size, "%d\n", games[g].target);
+		}
+
+	start = now_ns();
+	for (r = 0; r < repeat; r++)
+		for (line = text; line < text + size; line = end + 1)
+			{
+			end = memchr(line, '\n', text + size - line);
+			errors += cifras_parse_values(line, end, values, MAX_NUM_COUNT + 1,
+				&parsed) != 0;
+			}
+	seconds = (now_ns() - start) / 1e9;
+	if (errors != 0)
+		fprintf(stderr, "Error in run_parse: %d lines not parsed\n", errors);
+
+	if (format == FORMAT_CSV)
+		printf("group,bytes,seconds,mb_per_sec,lines_per_sec\n"
+			"parse,%zu,%.6f,%.1f,%.1f\n", size * repeat, seconds,
+			size * repeat / seconds / 1e6, lines * repeat / seconds);
+	else
+		printf("{\"results\": [\n    {\"group\": \"parse\", \"bytes\": %zu, "
+			"\"seconds\": %.6f, \"mb_per_sec\": %.1f, \"lines_per_sec\": %.1f}"
+			"\n    ]}\n", size * repeat, seconds, size * repeat / seconds / 1e6,
+			lines * repeat / seconds);
+	free(text);
+	return 0;
+	}
+
+static void report(const char* group, const BenchSample* samples, size_t count,
+	BenchFormat format, bool first)
+	{
+	double* latencies;
+	double total_ns = 0;
+	unsigned long long nodes_total = 0, nodes_max = 0;
+	size_t i;
+
+	latencies = malloc(sizeof(double) * count);
+	if (latencies == NULL)
+		{
+		fprintf(stderr, "Error in report: out of memory\n");
+		exit(EXIT_FAILURE);
+		}
+	for (i = 0; i < count; i++)
+		{
+		latencies[i] = samples[i].elapsed_ns;
+		total_ns += samples[i].elapsed_ns;
+		nodes_total += samples[i].nodes;
+		if (samples[i].nodes > nodes_max)
+			nodes_max = samples[i].nodes;
+		}
+	qsort(latencies, count, sizeof(double), compare_doubles);
+
+#define BENCH_ROW_VALUES group, count, total_ns / 1e9, count / (total_ns / 1e9), \
+	latencies[count / 2] / 1e3, latencies[(count * 99) / 100] / 1e3, \
+	latencies[count - 1] / 1e3, (double)nodes_total / count, nodes_max
+	if (format == FORMAT_CSV)
+		printf("%s,%zu,%.6f,%.1f,%.2f,%.2f,%.2f,%.1f,%llu\n", BENCH_ROW_VALUES);
+	else
+		printf("%s\n    {\"group\": \"%s\", \"games\": %zu, \"seconds\": %.6f, "
+			"\"games_per_sec\": %.1f, \"p50_us\": %.2f, \"p99_us\": %.2f, "
+			"\"max_us\": %.2f, \"nodes_mean\": %.1f, \"nodes_max\": %llu}",
+			first ? "" : ",", BENCH_ROW_VALUES);
+#undef BENCH_ROW_VALUES
+
+	free(latencies);
+	}
+
+int main(int argc, char** argv)
+	{
+	BenchFormat format = FORMAT_CSV;
+	size_t games_count = BENCH_DEFAULT_GAMES;
+	uint64_t seed = BENCH_DEFAULT_SEED;
+	int repeat = BENCH_DEFAULT_REPEAT;
+	int numbers_count = NUM_COUNT;
+	CifrasEngine engine = CIFRAS_ENGINE_BT;
+	unsigned bounds = CIFRAS_BOUNDS_DEFAULT;
+	bool parse = false;
+	BenchGame* games;
+	BenchSample* samples;
+	size_t i, hard_count;
+	int r;
+
+	for (i = 1; i < (size_t)argc; i++)
+		{
+		if (strcmp(argv[i], "--csv") == 0)
+			format = FORMAT_CSV;
+		else if (strcmp(argv[i], "--json") == 0)
+			format = FORMAT_JSON;
+		else if (strcmp(argv[i], "--games") == 0 && i + 1 < (size_t)argc)
+			games_count = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < (size_t)argc)
+			seed = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < (size_t)argc)
+			repeat = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--numbers") == 0 && i + 1 < (size_t)argc)
+			numbers_count = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--engine") == 0 && i + 1 < (size_t)argc &&
+			cifras_engine_from_name(argv[i + 1], &engine))
+			i++;
+		else if (strcmp(argv[i], "--bounds") == 0 && i + 1 < (size_t)argc &&
+			parse_bounds(argv[i + 1], &bounds))
+			i++;
+		else if (strcmp(argv[i], "--parse") == 0)
+			parse = true;
+		else
+			{
+			fprintf(stderr, "Usage: %s [--csv|--json] [--games N] [--seed S] "
+				"[--repeat R] [--numbers C] [--engine " CIFRAS_ENGINE_NAMES "] "
+				"[--bounds LIST] [--parse]\n", argv[0]);
+			return 1;
+			}
+		}
+	if (games_count == 0 || repeat <= 0)
+		{
+		fprintf(stderr, "Error in main: --games and --repeat must be positive\n");
+		return 1;
+		}
+	if (numbers_count < MIN_NUM_COUNT || numbers_count > MAX_NUM_COUNT)
+		{
+		fprintf(stderr, "Error in main: --numbers must be between %d and %d\n",
+			MIN_NUM_COUNT, MAX_NUM_COUNT);
+		return 1;
+		}
+
+	if (parse)
+		{
+		games = malloc(sizeof(BenchGame) * games_count);
+		if (games == NULL)
+			{
+			fprintf(stderr, "Error in main: out of memory\n");
+			return 1;
+			}
+		generate_corpus(games, games_count, numbers_count, seed);
+		i = run_parse(games, games_count, repeat, format);
+		free(games);
+		if (i != 0)
+			fprintf(stderr, "Error in main: out of memory\n");
+		return i != 0;
+		}
+
+	hard_count = HARD_GAMES_COUNT * repeat;
+	games = malloc(sizeof(BenchGame) * games_count);
+	samples = malloc(sizeof(BenchSample) *
+		(games_count > hard_count ? games_count : hard_count));
+	if (games == NULL || samples == NULL)
+		{
+		fprintf(stderr, "Error in main: out of memory\n");
+		return 1;
+		}
+
+	if (format == FORMAT_CSV)
+		printf("group,games,seconds,games_per_sec,p50_us,p99_us,max_us,"
+			"nodes_mean,nodes_max\n");
+	else
+		printf("{\"num_count\": %d, \"seed\": %llu, \"results\": [",
+			numbers_count, (unsigned long long)seed);
+
+	// Random games
+	generate_corpus(games, games_count, numbers_count, seed);
+	for (i = 0; i < games_count; i++)
+		run_game(&games[i], engine, bounds, &samples[i]);
+	report("random", samples, games_count, format, true);
+
+	// Hard games
+	if (numbers_count == NUM_COUNT)
+		{
+		for (r = 0; r < repeat; r++)
+			for (i = 0; i < HARD_GAMES_COUNT; i++)
+				run_game(&HARD_GAMES[i], engine, bounds,
+					&samples[r * HARD_GAMES_COUNT + i]);
+		report("hard", samples, hard_count, format, false);
+		}
+
+	if (format == FORMAT_JSON)
+		printf("\n    ]}\n");
+
+	free(games);
+	free(samples);
+	return 0;
+	}
@@ -1,9 +1,19 @@
 #include "cifras_bt.h"
+#include "cifras_dp.h"
+#include "cifras_leaf.h"
+#include "cifras_ops.h"
+#include "cifras_tt.h"
+#include "work_pool.h"
 
 #include <assert.h>
+#include <limits.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>	
+#include <string.h>
+#include <time.h>
 
 // ADT stack implemented in cifras_bt.h as inline functions, except
 // steps_stack_copy because it is more complex
@@ -67,105 +77,229 @@ static int steps_stack_compare(const SolutionStepStack* stack1,
 	assert(false);
 	}
 
-// 1. Put new in new_array[0].
-// 2. Copy the elements of former_array into new array starting from
-// new_array[1] skiping former_array[old_pos1] and former_array[old_pos2]
-static void build_next_numbers(long int* new_array, const long int* former_array,
-	int old_pos1, int old_pos2, long int new)
+// The best solution known by a search is summarized in one word as
+// (diff << BEST_KEY_COUNT_BITS) | steps count, where diff is the distance
+// between its result and the target. Comparing two keys gives the same order
+// as steps_stack_compare, so the threads of resolve_cifras_mt can share the
+// best solution found so far through a single atomic word
+#define BEST_KEY_COUNT_BITS 8
+#define BEST_KEY_COUNT_MASK ((1ULL << BEST_KEY_COUNT_BITS) - 1)
+#define BEST_KEY_EMPTY ULLONG_MAX
+// Wide games clamp larger distances (see make_best_key_wide)
+#define BEST_KEY_MAX_DIFF ((1ULL << (64 - BEST_KEY_COUNT_BITS)) - 1)
+
+// Instrumentation (SearchStats). Nothing is compiled without CIFRAS_STATS
+#ifdef CIFRAS_STATS
+	#define STATS_ADD(ctx, field) \
+		do { if ((ctx)->stats != NULL) (ctx)->stats->field++; } while (0)
+	#define STATS_ADD_IF(ctx, condition, field) \
+		do { if ((ctx)->stats != NULL && (condition)) (ctx)->stats->field++; } \
+		while (0)
+#else
+	#define STATS_ADD(ctx, field) ((void)0)
+	#define STATS_ADD_IF(ctx, condition, field) ((void)0)
+#endif
+
+// Number of recursion levels expanded by resolve_cifras_mt to build its tasks
+#define MT_SPLIT_DEPTH 2
+// Nodes visited between two reads of the clock in resolve_cifras_budget
+#define DEADLINE_CHECK_NODES 256
+// Levels of distinct states kept by resolve_cifras_deepening
+#define DEEPENING_CACHE_DEPTH 2
+
+typedef struct
 	{
-	int i, j;
-	
-	assert(former_array != NULL);
-	assert(new_array != NULL);
-	assert(old_pos1 >= 0);
-	assert(old_pos1 < NUM_COUNT);
-	assert(old_pos2 >= 0);
-	assert(old_pos2 < NUM_COUNT);
-	assert(new > 0);
+	int target;
+	SolutionStepStack* best_steps;
+	// Key of best_steps
+	unsigned long long best;
+	// Best key shared between the threads of resolve_cifras_mt.
+	// NULL for single-threaded searches
+	_Atomic unsigned long long* shared_best;
+	// Repeated states are cut if not NULL
+	TranspositionTable* tt;
+	// Instrumentation if not NULL (only with CIFRAS_STATS)
+	SearchStats* stats;
+	// Nodes of 3 numbers are solved by leaf_kernel_best if the CPU allows it
+	bool leaf_kernel;
+	// The values may overflow (numbers_are_narrow is false): steps and keys
+	// are built with overflow checks
+	bool wide;
+	// CIFRAS_BOUND_* used to cut subtrees
+	unsigned bounds;
+	// Nodes with this many steps are not expanded (depth limit of the
+	// passes of resolve_cifras_deepening; MAX_SOLUTION_STEPS otherwise)
+	int max_steps;
+	double start_ns;
+	// Anytime search (resolve_cifras_budget): the search unwinds once the
+	// clock reaches deadline_ns (0 if there is no deadline) and progress,
+	// if not NULL, is called with every new best solution
+	uint64_t deadline_ns;
+	int deadline_countdown;
+	bool stopped;
+	CifrasProgressFn progress;
+	void* progress_arg;
+	// Node where the search starts: its numbers and the steps done to reach
+	// it (only the tasks of resolve_cifras_mt start below the root)
+	long int root_numbers[MAX_NUM_COUNT];
+	int root_count;
+	SolutionStepStack root_steps;
+	// Path from the search root to the current node, one step_code per step.
+	// The steps themselves (SolutionStep) are only rebuilt when the path
+	// becomes the best solution
+	uint8_t codes[MAX_SOLUTION_STEPS];
+	int depth;
+	// Pending numbers of the current node
+	long int numbers[MAX_NUM_COUNT];
+	} SearchContext;
 
-	new_array[0] = new;
-	
-	j = 1;
-	for (i = 0; i < NUM_COUNT; i++)
-		if (i != old_pos1 && i != old_pos2)
-			new_array[j++] = former_array[i];
+static double now_ns(void)
+	{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
 	}
-	
-static void build_candidates_stack(SolutionStepStack* stack,
-	long int operand1, long int operand2)
+
+static inline unsigned long long make_best_key(long int result, int target,
+	int steps_count)
 	{
-	SolutionStep step;
-	
-	assert(stack != NULL);
-	assert(operand1 > 0 && operand2 > 0);
-		
-	steps_stack_init(stack);
+	assert(MAX_SOLUTION_STEPS <= BEST_KEY_COUNT_MASK);
+	return ((unsigned long long)labs(result - (long int)target)
+		<< BEST_KEY_COUNT_BITS) | (unsigned long long)steps_count;
+	}
+
+// make_best_key for results of any size. Distances beyond BEST_KEY_MAX_DIFF
+// are all taken as BEST_KEY_MAX_DIFF: such results are never nearer the
+// target than the numbers themselves, so they only compete with each other
+static inline unsigned long long make_best_key_wide(long int result,
+	int target, int steps_count)
+	{
+	unsigned long long diff = (unsigned long long)labs(result - (long int)target);
 	
-	// Add
-	step = (SolutionStep){operand1 + operand2, operand1, operand2, '+'};
-	steps_stack_push(stack, &step);
+	if (diff > BEST_KEY_MAX_DIFF)
+		diff = BEST_KEY_MAX_DIFF;
+	return (diff << BEST_KEY_COUNT_BITS) | (unsigned long long)steps_count;
+	}
+
+// Key and step of a search of a narrow or a wide game (SearchContext.wide).
+// wide is a constant in cifras_bt_node, so the narrow search keeps the plain
+// arithmetic
+static inline unsigned long long search_key(bool wide, long int result,
+	int target, int steps_count)
+	{
+	if (wide)
+		return make_best_key_wide(result, target, steps_count);
+	return make_best_key(result, target, steps_count);
+	}
+
+static inline bool search_candidate(bool wide, SolutionStep* step,
+	long int operand1, long int operand2, int op_index)
+	{
+	if (wide)
+		return build_candidate_wide(step, operand1, operand2, op_index);
+	return build_candidate(step, operand1, operand2, op_index);
+	}
+
+static inline unsigned long long best_key(const SolutionStepStack* stack,
+	int target)
+	{
+	if (steps_stack_is_empty(stack))
+		return BEST_KEY_EMPTY;
+	return make_best_key_wide(steps_stack_result(stack), target,
+		steps_stack_count(stack));
+	}
+
+// Best key known by this search, taking into account the other threads
+static inline unsigned long long search_best_key(const SearchContext* ctx)
+	{
+	unsigned long long shared;
 	
-	// Substract (no action if operand1 == operand2)
-	if (operand1 != operand2)
-		{
-		if (operand1 > operand2)
-			step = (SolutionStep){operand1 - operand2, operand1, operand2, '-'};
-		else if (operand2 > operand1)
-			step = (SolutionStep){operand2 - operand1, operand2, operand1, '-'};
-		steps_stack_push(stack, &step);
-		}
+	if (ctx->shared_best == NULL)
+		return ctx->best;
+	shared = atomic_load_explicit(ctx->shared_best, memory_order_relaxed);
+	return shared < ctx->best ? shared : ctx->best;
+	}
 
-	// Prune if any of the operands is 1. Either multiplying or dividing by 1
-	// introduces a useless operation.
-	//
-	// A recursive branch with a useless operation will never be the best
-	// because there will be always, at least, one branch with the same result
-	// but shorter (with less operations).
-	if (operand1 == 1 || operand2 == 1)
+// Lower the shared key to key if the latter is better
+static inline void search_publish_key(const SearchContext* ctx,
+	unsigned long long key)
+	{
+	unsigned long long shared;
+	
+	if (ctx->shared_best == NULL)
 		return;
+	shared = atomic_load_explicit(ctx->shared_best, memory_order_relaxed);
+	while (key < shared && atomic_compare_exchange_weak_explicit(ctx->shared_best,
+		&shared, key, memory_order_relaxed, memory_order_relaxed) == false)
+		;
+	}
+
+// Rebuild the steps of the current path into best_steps
+static void search_record_best(SearchContext* ctx, unsigned long long key)
+	{
+#ifdef CIFRAS_STATS
+	if (ctx->stats != NULL && ctx->stats->first_exact_ns < 0 &&
+		(key >> BEST_KEY_COUNT_BITS) == 0)
+		ctx->stats->first_exact_ns = now_ns() - ctx->start_ns;
+#endif
+	STATS_ADD(ctx, best_copies);
+	steps_stack_copy(ctx->best_steps, &ctx->root_steps);
+	steps_stack_from_codes(ctx->best_steps, ctx->root_numbers, ctx->root_count,
+		ctx->codes, ctx->depth);
+	ctx->best = key;
+	search_publish_key(ctx, key);
+	if (ctx->progress != NULL)
+		ctx->progress(ctx->best_steps, ctx->progress_arg);
+	}
+
+uint64_t cifras_now_ns(void)
+	{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+	}
+
+// True once the deadline has passed. The clock is only read every
+// DEADLINE_CHECK_NODES calls
+static inline bool search_out_of_time(SearchContext* ctx)
+	{
+	if (ctx->stopped)
+		return true;
+	if (--ctx->deadline_countdown > 0)
+		return false;
+	ctx->deadline_countdown = DEADLINE_CHECK_NODES;
+	ctx->stopped = cifras_now_ns() >= ctx->deadline_ns;
+	return ctx->stopped;
+	}
+
+// Solve the node of 3 numbers at once with the leaf kernel
+static void search_leaf_kernel(SearchContext* ctx, int steps_count)
+	{
+	unsigned long long key;
+	int count;
 	
-	// Multiply
-	step = (SolutionStep){operand1 * operand2, operand1, operand2, '*'};
-	steps_stack_push(stack, &step);
-	
-	// Divide
-	//
-	// Optimization maximized. It is the most CPU-expensive operation.
-	//
-	// If dividend == divisor, set the result directly to 1 instead of
-	// executing the division in order to save CPU cycles
-	if (operand1 == operand2)
-		{
-		step = (SolutionStep){1, operand1, operand2, '/'};
-		steps_stack_push(stack, &step);
-		}
-	// The operands are compared before the modulo operation. That saves
-	// one modulo operation (1 vs 2) if operand1 != operand2
-	else if (operand1 > operand2 && operand1 % operand2 == 0)
-		{
-		step = (SolutionStep){operand1 / operand2, operand1, operand2, '/'};
-		steps_stack_push(stack, &step);
-		}
-	else if (operand2 > operand1 && operand2 % operand1 == 0)
-		{
-		step = (SolutionStep){operand2 / operand1, operand2, operand1, '/'};
-		steps_stack_push(stack, &step);
-		}
+	STATS_ADD(ctx, leaf_kernels);
+	if (leaf_kernel_best(ctx->numbers, ctx->target, steps_count, ctx->best,
+		&key, &ctx->codes[ctx->depth], &count) == false)
+		return;
+	ctx->depth += count;
+	search_record_best(ctx, key);
+	ctx->depth -= count;
 	}
 
 // Return true if the exact number has been already found and therefore a
 // solution with more steps can never be better
-static inline bool prunable_length(const SolutionStepStack* current_steps,
-	const SolutionStepStack* best_steps, int target)
+static inline bool prunable_length(int steps_count, unsigned long long best)
 	{
-	if (steps_stack_is_empty(current_steps))
+	if (steps_count == 0)
 		return false;
-	assert(steps_stack_is_empty(best_steps) == false);
+	assert(best != BEST_KEY_EMPTY);
 
-	if (steps_stack_result(best_steps) != (long int)target)
+	// Exact not found yet
+	if ((best >> BEST_KEY_COUNT_BITS) != 0)
 		return false;
 
-	if (steps_stack_count(current_steps) < steps_stack_count(best_steps))
+	if ((unsigned long long)steps_count < (best & BEST_KEY_COUNT_MASK))
 		return false;
 
 	return true;
@@ -173,13 +307,13 @@ static inline bool prunable_length(const SolutionStepStack* current_steps,
 
 // Calculation of an additional prune.
 // True if all the following conditions are satisfied:
-// 1. best_steps is not empty.
+// 1. There is a best solution (best != BEST_KEY_EMPTY).
 // 2. The highest value obtained by combining the pending numbers is smaller
 // than the target.
 // 3. The highest value obtained by combining the pending numbers is further
-// from the target than the result of best_steps.
+// from the target than the result of the best solution.
 static bool prunable_upper_value(const long int* numbers, int numbers_count,
-	int target, const SolutionStepStack* best_steps)
+	int target, unsigned long long best)
 	{
 	long int upper_value = 1;
 	long int upper_value_diff;
@@ -188,10 +322,9 @@ static bool prunable_upper_value(const long int* numbers, int numbers_count,
 	
 	assert(numbers != NULL);
 	assert(numbers_count > 0);
-	assert(best_steps != NULL);
 	
-	// No prune if best_steps is empty
-	if (steps_stack_is_empty(best_steps))
+	// No prune if there is no best solution yet
+	if (best == BEST_KEY_EMPTY)
 		return false;
 
 	for (i = 0; i < numbers_count; i++)
@@ -199,102 +332,1232 @@ static bool prunable_upper_value(const long int* numbers, int numbers_count,
 		assert(numbers[i] >= 1);
 		
 		// Upper bound estimate: multiplying by 2 will never reach a value
-		// smaller than any other one combining the number 1
-		if (numbers[i] == 1)
-			upper_value *= 2;
-		else
-			upper_value *= numbers[i];
-		
-		// No prune if upper_value is larger than target
-		if (upper_value >= (long int)target)
+		// smaller than any other one combining the number 1.
+		// No prune if upper_value is larger than target (or than LONG_MAX
+		// in wide games)
+		if (__builtin_mul_overflow(upper_value, numbers[i] == 1 ? 2 : numbers[i],
+			&upper_value) || upper_value >= (long int)target)
 			return false;
 		}
 
 	assert(upper_value < (long int)target);
 	upper_value_diff = (long int)target - upper_value;
-	best_diff = labs(steps_stack_result(best_steps) - (long int)target);
+	best_diff = (long int)(best >> BEST_KEY_COUNT_BITS);
 	// If upper_value_diff == best_diff, there must be no prune because the
 	// current solution may be better than the best if its steps count is smaller
 	return upper_value_diff > best_diff;
 	}
 
-static void cifras_bt(const long int* numbers, int numbers_count,
-	int target,
-	const SolutionStepStack* current_steps, SolutionStepStack* best_steps) 
+// Tighter version of prunable_length. Every child has at least
+// steps_count + 1 steps, so once the exact result is known no child can be
+// better if that is not fewer than the steps of the best solution
+static inline bool prunable_step_count(int steps_count, unsigned long long best)
+	{
+	if (best == BEST_KEY_EMPTY || (best >> BEST_KEY_COUNT_BITS) != 0)
+		return false;
+	return (unsigned long long)steps_count + 1 >= (best & BEST_KEY_COUNT_MASK);
+	}
+
+// Upper bound of the values reachable by combining at most count of the
+// numbers sorted (descending, 1 counted as 2; see prunable_upper_value).
+// Stop as soon as cap is reached
+static inline long int largest_product(const long int* sorted, int count,
+	long int cap)
+	{
+	long int product = 1;
+	int i;
+	
+	for (i = 0; i < count && product < cap; i++)
+		if (__builtin_mul_overflow(product, sorted[i], &product))
+			return cap;
+	return product;
+	}
+
+// prunable_upper_value split by the steps of the children. A solution found
+// below this node with k more steps combines at most k + 1 pending numbers.
+// It is better than best if:
+// 1. k <= best steps - 1 - steps_count and it is at most as far from the
+// target as best, or
+// 2. k is larger and it is strictly nearer the target than best.
+// Prune if no upper bound of either group reaches the distance required
+static bool prunable_depth_value(const long int* numbers, int numbers_count,
+	int target, int steps_count, unsigned long long best)
+	{
+	long int sorted[MAX_NUM_COUNT];
+	long int best_diff, value, upper_value_diff;
+	int tie_steps, i, j;
+	
+	assert(numbers_count > 0 && numbers_count <= MAX_NUM_COUNT);
+	
+	if (best == BEST_KEY_EMPTY)
+		return false;
+	best_diff = (long int)(best >> BEST_KEY_COUNT_BITS);
+	// Most steps that still win on steps count with the same distance
+	tie_steps = (int)(best & BEST_KEY_COUNT_MASK) - 1 - steps_count;
+	
+	// Bound of any number of steps, as in prunable_upper_value
+	value = 1;
+	for (i = 0; i < numbers_count && value < (long int)target; i++)
+		if (__builtin_mul_overflow(value, numbers[i] == 1 ? 2 : numbers[i],
+			&value))
+			return false;
+	upper_value_diff = (long int)target - value;
+	if (upper_value_diff > best_diff)
+		return true;
+	// 2. More steps, strictly nearer the target
+	if (tie_steps < numbers_count - 1 && upper_value_diff < best_diff)
+		return false;
+	// 1. No more than tie_steps steps
+	if (tie_steps < 1)
+		return true;
+	if (tie_steps >= numbers_count - 1)
+		return false;
+	
+	// Descending insertion sort to take the tie_steps + 1 largest numbers
+	for (i = 0; i < numbers_count; i++)
+		{
+		value = numbers[i] == 1 ? 2 : numbers[i];
+		for (j = i; j > 0 && sorted[j - 1] < value; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = value;
+		}
+	return (long int)target - largest_product(sorted, tie_steps + 1, target) >
+		best_diff;
+	}
+
+// Search of the nodes with a given count of pending numbers. There is one
+// per count (cifras_bt_1 ... cifras_bt_MAX_NUM_COUNT) and each one calls the
+// next smaller one
+typedef void (*CifrasBtFn)(SearchContext* ctx, int last_pos,
+	const SolutionStep* last_step);
+
+// Search state lives in ctx and is updated in place: every node appends the
+// code of the step it tries to ctx->codes and replaces its two operands in
+// ctx->numbers (numbers_replace_pair), then undoes both after the recursive
+// call.
+//
+// Always inlined into the functions defined by CIFRAS_BT_DEFINE, so
+// numbers_count is a constant there: the base cases fold away and the pair
+// loops are unrolled.
+//
+// numbers_count: pending numbers (the first ones of ctx->numbers).
+// last_pos: position of the result of the last step or -1 at the root.
+// last_step: last step (NULL at the root).
+// child: search of the nodes with numbers_count - 1 numbers.
+// wide: ctx->wide, as a constant
+static inline __attribute__((always_inline)) void cifras_bt_node(
+	SearchContext* ctx, const int numbers_count, int last_pos,
+	const SolutionStep* last_step, CifrasBtFn child, const bool wide)
 	{	
-	int i, j;
+	long int* numbers = ctx->numbers;
 	SolutionStep candidate;
-	SolutionStepStack candidate_steps, next_steps;
-	long int next_numbers[NUM_COUNT];
+	long int operand1, operand2;
+	unsigned long long key, best;
+	int steps_count, i, j, op;
+	
+	steps_count = ctx->root_steps.count + ctx->depth;
+	STATS_ADD(ctx, nodes[steps_count]);
 	
-	// If current_steps reaches a better result than best_steps, then
-	// mirror current_steps into best_steps
-	if (steps_stack_compare(current_steps, best_steps, target) == -1)
-		steps_stack_copy(best_steps, current_steps);
+	// If the path reaches a better result than best_steps, then mirror it
+	// into best_steps
+	if (last_pos >= 0)
+		{
+		key = search_key(wide, numbers[last_pos], ctx->target, steps_count);
+		if (key < ctx->best)
+			search_record_best(ctx, key);
+		}
 
 	// Base cases: 
 	// 1. Only 1 number pending, therefore no more combinations are possible
 	assert(numbers_count > 0);
 	if (numbers_count == 1)
 		return;
+	if (steps_count >= ctx->max_steps)
+		return;
+	if (ctx->deadline_ns != 0 && search_out_of_time(ctx))
+		return;
+	best = search_best_key(ctx);
 	// 2. Prune if exact has been already found and the current steps count
 	// is higher than the exact solution
-	if (prunable_length(current_steps, best_steps, target))
+	if ((ctx->bounds & CIFRAS_BOUND_LENGTH) &&
+		prunable_length(steps_count, best))
+		{
+		STATS_ADD(ctx, pruned_length);
+		return;
+		}
+	if ((ctx->bounds & CIFRAS_BOUND_STEP_COUNT) &&
+		prunable_step_count(steps_count, best))
+		{
+		STATS_ADD(ctx, pruned_step_count);
 		return;
+		}
 	// 3. Prune is the upper value obtained by combining all the pending
 	// numbers is smaller than the target AND is further from the target than
-	// the result of best_steps
-	if (prunable_upper_value(numbers, numbers_count, target, best_steps))
+	// the result of the best solution
+	if ((ctx->bounds & CIFRAS_BOUND_UPPER_VALUE) &&
+		prunable_upper_value(numbers, numbers_count, ctx->target, best))
+		{
+		STATS_ADD(ctx, pruned_upper_value);
+		return;
+		}
+	if ((ctx->bounds & CIFRAS_BOUND_DEPTH_VALUE) &&
+		prunable_depth_value(numbers, numbers_count, ctx->target, steps_count,
+		best))
+		{
+		STATS_ADD(ctx, pruned_depth_value);
+		return;
+		}
+	// 4. The whole subtree of 3 numbers fits in the leaf kernel
+	if (numbers_count == 3 && ctx->leaf_kernel &&
+		steps_count + 2 <= ctx->max_steps &&
+		leaf_kernel_fits(numbers, ctx->target))
+		{
+		search_leaf_kernel(ctx, steps_count);
 		return;
+		}
+	// 5. Prune if the same multiset of numbers has been already explored
+	if (ctx->tt != NULL)
+		{
+		transposition_table_count_node(ctx->tt);
+		if (numbers_count >= TT_MIN_NUMBERS &&
+			transposition_table_visit(ctx->tt, numbers, numbers_count))
+			{
+			STATS_ADD(ctx, pruned_transposition);
+			return;
+			}
+		}
 
 	// From here onwards, recursive case
+	assert(steps_count < MAX_SOLUTION_STEPS);
+	
+#pragma GCC unroll 8
 	for (i = 0; i < numbers_count; i++) 
 		{
+		// Skip pairs of values already combined in this node
+		if (repeated_operand(numbers, 0, i))
+			{
+			STATS_ADD(ctx, pruned_symmetry);
+			continue;
+			}
+#pragma GCC unroll 8
 		for (j = i + 1; j < numbers_count; j++)
 			{
-			// Stack candidate steps
-			// Operands: numbers[i] and numbers[j]
-			build_candidates_stack(&candidate_steps, numbers[i], numbers[j]);
-				
-			// Initialize next_steps with a copy of current_steps
-			steps_stack_copy(&next_steps, current_steps);
+			if (repeated_operand(numbers, i + 1, j))
+				{
+				STATS_ADD(ctx, pruned_symmetry);
+				continue;
+				}
+			STATS_ADD_IF(ctx, numbers[i] == 1 || numbers[j] == 1,
+				pruned_operand_one);
 			
-			// Pop candidates one by one and make a recursive call with
-			// everyone of them
-			while (steps_stack_is_empty(&candidate_steps) == false)
+			operand1 = numbers[i];
+			operand2 = numbers[j];
+			// Same order as popping the stack of build_candidates_stack
+			for (op = 3; op >= 0; op--)
 				{
-				// Push next candidate
-				steps_stack_pop(&candidate_steps, &candidate);
-				steps_stack_push(&next_steps, &candidate);
+				if (search_candidate(wide, &candidate, operand1, operand2,
+					op) == false)
+					continue;
+				// Skip the step if it is independent of the last one (it does
+				// not use its result) and it must go before it
+				if (last_step != NULL && i != last_pos && j != last_pos &&
+					steps_out_of_order(last_step, &candidate))
+					{
+					STATS_ADD(ctx, pruned_symmetry);
+					continue;
+					}
+				// Children at the depth limit are only compared with the best
+				if (steps_count + 1 >= ctx->max_steps)
+					{
+					STATS_ADD(ctx, nodes[steps_count + 1]);
+					key = search_key(wide, candidate.result, ctx->target,
+						steps_count + 1);
+					if (key < ctx->best)
+						{
+						ctx->codes[ctx->depth++] = step_code(i, j, op);
+						search_record_best(ctx, key);
+						ctx->depth--;
+						}
+					continue;
+					}
 				
-				// Create numbers array for the recursive call
-				build_next_numbers(next_numbers, numbers, i, j, candidate.result);
+				ctx->codes[ctx->depth++] = step_code(i, j, op);
+				numbers_replace_pair(numbers, numbers_count, i, j,
+					candidate.result);
 				
 				// Recursive call
-				cifras_bt(next_numbers, numbers_count - 1, target,
-					&next_steps, best_steps);
+				child(ctx, i, &candidate);
 				
-				// Restore next_steps. More than one candidate step must not
-				// be pushed for the same recursive call
-				steps_stack_pop(&next_steps, NULL);
+				// Restore
+				numbers_restore_pair(numbers, i, j, operand1, operand2);
+				ctx->depth--;
 				}
 			}
 		}
 	}
 
-// Wrapper
+// Narrow (cifras_bt_n) and wide (cifras_bt_wide_n) search of the nodes of n
+// numbers
+#define CIFRAS_BT_DEFINE(n, next, wide_next) \
+	static void cifras_bt_##n(SearchContext* ctx, int last_pos, \
+		const SolutionStep* last_step) \
+		{ \
+		cifras_bt_node(ctx, n, last_pos, last_step, next, false); \
+		} \
+	static void cifras_bt_wide_##n(SearchContext* ctx, int last_pos, \
+		const SolutionStep* last_step) \
+		{ \
+		cifras_bt_node(ctx, n, last_pos, last_step, wide_next, true); \
+		}
+
+#if MAX_NUM_COUNT != 8
+	#error "Define one cifras_bt_n for every count up to MAX_NUM_COUNT"
+#endif
+CIFRAS_BT_DEFINE(1, NULL, NULL)
+CIFRAS_BT_DEFINE(2, cifras_bt_1, cifras_bt_wide_1)
+CIFRAS_BT_DEFINE(3, cifras_bt_2, cifras_bt_wide_2)
+CIFRAS_BT_DEFINE(4, cifras_bt_3, cifras_bt_wide_3)
+CIFRAS_BT_DEFINE(5, cifras_bt_4, cifras_bt_wide_4)
+CIFRAS_BT_DEFINE(6, cifras_bt_5, cifras_bt_wide_5)
+CIFRAS_BT_DEFINE(7, cifras_bt_6, cifras_bt_wide_6)
+CIFRAS_BT_DEFINE(8, cifras_bt_7, cifras_bt_wide_7)
+
+static const CifrasBtFn CIFRAS_BT_BY_COUNT[MAX_NUM_COUNT + 1] =
+	{
+	NULL, cifras_bt_1, cifras_bt_2, cifras_bt_3, cifras_bt_4, cifras_bt_5,
+	cifras_bt_6, cifras_bt_7, cifras_bt_8
+	};
+
+static const CifrasBtFn CIFRAS_BT_WIDE_BY_COUNT[MAX_NUM_COUNT + 1] =
+	{
+	NULL, cifras_bt_wide_1, cifras_bt_wide_2, cifras_bt_wide_3,
+	cifras_bt_wide_4, cifras_bt_wide_5, cifras_bt_wide_6, cifras_bt_wide_7,
+	cifras_bt_wide_8
+	};
+
+// Runtime dispatch to the search specialised for numbers_count
+static void cifras_bt(SearchContext* ctx, int numbers_count, int last_pos,
+	const SolutionStep* last_step)
+	{
+	assert(numbers_count > 0 && numbers_count <= MAX_NUM_COUNT);
+	if (ctx->wide)
+		CIFRAS_BT_WIDE_BY_COUNT[numbers_count](ctx, last_pos, last_step);
+	else
+		CIFRAS_BT_BY_COUNT[numbers_count](ctx, last_pos, last_step);
+	}
+
+// Greedy descent from numbers (numbers_count numbers, reached with the
+// codes ctx->codes[0..ctx->depth - 1]): take at every level the step whose
+// result is nearest the target. Every prefix of the path is a candidate for
+// best_steps. numbers is modified
+static void search_greedy_descent(SearchContext* ctx, long int* numbers,
+	int numbers_count)
+	{
+	SolutionStep candidate;
+	long int diff, chosen_diff, chosen_result;
+	unsigned long long key;
+	int n, i, j, op, chosen_i, chosen_j, chosen_op;
+	
+	for (n = numbers_count; n > 1; n--)
+		{
+		chosen_diff = -1;
+		chosen_result = chosen_i = chosen_j = chosen_op = 0;
+		for (i = 0; i < n; i++)
+			for (j = i + 1; j < n; j++)
+				for (op = 0; op < 4; op++)
+					{
+					if (search_candidate(ctx->wide, &candidate, numbers[i],
+						numbers[j], op) == false)
+						continue;
+					diff = labs(candidate.result - (long int)ctx->target);
+					if (chosen_diff < 0 || diff < chosen_diff)
+						{
+						chosen_diff = diff;
+						chosen_result = candidate.result;
+						chosen_i = i;
+						chosen_j = j;
+						chosen_op = op;
+						}
+					}
+		// Only wide games can run out of steps (every addition overflows)
+		if (chosen_diff < 0)
+			return;
+		
+		ctx->codes[ctx->depth++] = step_code(chosen_i, chosen_j, chosen_op);
+		numbers_replace_pair(numbers, n, chosen_i, chosen_j, chosen_result);
+		key = search_key(ctx->wide, chosen_result, ctx->target,
+			ctx->root_steps.count + ctx->depth);
+		if (key < ctx->best)
+			search_record_best(ctx, key);
+		if (chosen_diff == 0)
+			return;
+		}
+	}
+
+// Quick first solution: one greedy descent (search_greedy_descent) after
+// every possible first step. ctx->numbers is left untouched
+static void search_greedy(SearchContext* ctx, int numbers_count)
+	{
+	long int numbers[MAX_NUM_COUNT];
+	SolutionStep candidate;
+	int i, j, op;
+	
+	assert(ctx->depth == 0);
+	for (i = 0; i < numbers_count; i++)
+		for (j = i + 1; j < numbers_count; j++)
+			for (op = 0; op < 4; op++)
+				{
+				if (search_candidate(ctx->wide, &candidate, ctx->numbers[i],
+					ctx->numbers[j], op) == false)
+					continue;
+				memcpy(numbers, ctx->numbers, sizeof(long int) * numbers_count);
+				numbers_replace_pair(numbers, numbers_count, i, j,
+					candidate.result);
+				ctx->codes[0] = step_code(i, j, op);
+				ctx->depth = 1;
+				search_greedy_descent(ctx, numbers, numbers_count - 1);
+				ctx->depth = 0;
+				// Nothing can beat an exact result in 2 steps or less
+				if (ctx->best <= make_best_key(ctx->target, ctx->target, 2))
+					return;
+				}
+	}
+
+// State of the cache of resolve_cifras_deepening: the numbers of a node in
+// the layout of cifras_bt (numbers_replace_pair), the same ones sorted to
+// detect repeated multisets and the codes of the steps from the root
+typedef struct
+	{
+	long int numbers[MAX_NUM_COUNT];
+	long int sorted[MAX_NUM_COUNT];
+	uint8_t codes[DEEPENING_CACHE_DEPTH];
+	} DeepeningState;
+
+typedef struct
+	{
+	DeepeningState* states;
+	size_t count;
+	// Hash set of states: index + 1 or 0 if the slot is free
+	uint32_t* slots;
+	int slots_bits;
+	} DeepeningLevel;
+
+static uint64_t deepening_hash(const long int* sorted, int numbers_count)
+	{
+	uint64_t hash = (uint64_t)numbers_count;
+	int i;
+	
+	for (i = 0; i < numbers_count; i++)
+		{
+		hash = (hash ^ (uint64_t)sorted[i]) * 0x9E3779B97F4A7C15ULL;
+		hash ^= hash >> 29;
+		}
+	return hash;
+	}
+
+// Canonical form of a multiset: insertion sort
+static void deepening_sort(const long int* numbers, int numbers_count,
+	long int* sorted)
+	{
+	int i, j;
+	
+	for (i = 0; i < numbers_count; i++)
+		{
+		for (j = i; j > 0 && sorted[j - 1] > numbers[i]; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = numbers[i];
+		}
+	}
+
+// Most children of the nodes of count numbers (one per pair and operation)
+static size_t deepening_children(int count)
+	{
+	return (size_t)(count * (count - 1) / 2 * 4);
+	}
+
+// Room for the states of depth depth of a game of numbers_count numbers.
+// Return false if out of memory
+static bool deepening_level_init(DeepeningLevel* level, int numbers_count,
+	int depth)
+	{
+	size_t capacity = 1;
+	int d;
+	
+	for (d = 0; d < depth; d++)
+		capacity *= deepening_children(numbers_count - d);
+	level->count = 0;
+	level->states = malloc(sizeof(DeepeningState) * capacity);
+	// Load factor up to 1/2
+	for (level->slots_bits = 1; ((size_t)1 << level->slots_bits) < capacity * 2;
+		level->slots_bits++)
+		;
+	level->slots = calloc((size_t)1 << level->slots_bits, sizeof(uint32_t));
+	return level->states != NULL && level->slots != NULL;
+	}
+
+static void deepening_level_free(DeepeningLevel* level)
+	{
+	free(level->states);
+	free(level->slots);
+	}
+
+// Add state to level unless its multiset is already there
+static void deepening_level_add(DeepeningLevel* level,
+	const DeepeningState* state, int numbers_count)
+	{
+	size_t mask = ((size_t)1 << level->slots_bits) - 1;
+	size_t slot;
+	uint32_t index;
+	
+	for (slot = deepening_hash(state->sorted, numbers_count) >>
+		(64 - level->slots_bits); (index = level->slots[slot]) != 0;
+		slot = (slot + 1) & mask)
+		if (memcmp(level->states[index - 1].sorted, state->sorted,
+			sizeof(long int) * numbers_count) == 0)
+			return;
+	level->states[level->count++] = *state;
+	level->slots[slot] = (uint32_t)level->count;
+	}
+
+// Expand every state of parents (depth - 1 steps, numbers_count numbers) into
+// children, comparing every new result with the best solution. This is the
+// pass of depth depth of resolve_cifras_deepening. Stop as soon as the target
+// is reached
+static void deepening_expand(SearchContext* ctx, const DeepeningLevel* parents,
+	int numbers_count, int depth, DeepeningLevel* children)
+	{
+	const DeepeningState* parent;
+	DeepeningState child;
+	SolutionStep candidate;
+	unsigned long long key;
+	size_t p;
+	int i, j, op;
+	
+	for (p = 0; p < parents->count; p++)
+		{
+		parent = &parents->states[p];
+		memcpy(ctx->codes, parent->codes, depth - 1);
+		for (i = 0; i < numbers_count; i++)
+			{
+			if (repeated_operand(parent->numbers, 0, i))
+				continue;
+			for (j = i + 1; j < numbers_count; j++)
+				{
+				if (repeated_operand(parent->numbers, i + 1, j))
+					continue;
+				for (op = 0; op < 4; op++)
+					{
+					if (search_candidate(ctx->wide, &candidate,
+						parent->numbers[i], parent->numbers[j], op) == false)
+						continue;
+					STATS_ADD(ctx, nodes[ctx->root_steps.count + depth]);
+					ctx->codes[depth - 1] = step_code(i, j, op);
+					key = search_key(ctx->wide, candidate.result, ctx->target,
+						ctx->root_steps.count + depth);
+					if (key < ctx->best)
+						{
+						ctx->depth = depth;
+						search_record_best(ctx, key);
+						ctx->depth = 0;
+						if ((key >> BEST_KEY_COUNT_BITS) == 0)
+							return;
+						}
+					if (children == NULL)
+						continue;
+					
+					memcpy(child.numbers, parent->numbers,
+						sizeof(long int) * numbers_count);
+					numbers_replace_pair(child.numbers, numbers_count, i, j,
+						candidate.result);
+					deepening_sort(child.numbers, numbers_count - 1,
+						child.sorted);
+					memcpy(child.codes, ctx->codes, depth);
+					deepening_level_add(children, &child, numbers_count - 1);
+					}
+				}
+			}
+		}
+	}
+
+// Pass of the depths depth to max_steps: depth-limited cifras_bt from every
+// state of frontier (numbers_count numbers, DEEPENING_CACHE_DEPTH steps).
+// Their results were already compared with the target, so the searches start
+// with last_pos -1. Stop as soon as the target is reached in depth steps
+static void deepening_search(SearchContext* ctx,
+	const DeepeningLevel* frontier, int numbers_count, int depth, int max_steps)
+	{
+	const DeepeningState* state;
+	unsigned long long done = make_best_key(ctx->target, ctx->target, depth);
+	size_t s;
+	
+	ctx->max_steps = max_steps;
+	for (s = 0; s < frontier->count && ctx->best > done; s++)
+		{
+		state = &frontier->states[s];
+		memcpy(ctx->numbers, state->numbers, sizeof(long int) * numbers_count);
+		memcpy(ctx->codes, state->codes, DEEPENING_CACHE_DEPTH);
+		ctx->depth = DEEPENING_CACHE_DEPTH;
+		cifras_bt(ctx, numbers_count, -1, NULL);
+		}
+	}
+
+// steps: steps done to reach numbers (NULL at the root)
+static void search_context_init(SearchContext* ctx, int target,
+	SolutionStepStack* best_steps, const long int* numbers, int numbers_count,
+	const SolutionStepStack* steps)
+	{
+	int i;
+	
+	ctx->target = target;
+	ctx->best_steps = best_steps;
+	ctx->best = best_key(best_steps, target);
+	ctx->shared_best = NULL;
+	ctx->tt = NULL;
+	ctx->stats = NULL;
+	ctx->leaf_kernel = leaf_kernel_available();
+	ctx->wide = numbers_are_narrow(numbers, numbers_count) == false;
+	ctx->bounds = CIFRAS_BOUNDS_DEFAULT;
+	ctx->max_steps = MAX_SOLUTION_STEPS;
+	ctx->start_ns = 0;
+	ctx->deadline_ns = 0;
+	ctx->deadline_countdown = DEADLINE_CHECK_NODES;
+	ctx->stopped = false;
+	ctx->progress = NULL;
+	ctx->progress_arg = NULL;
+	for (i = 0; i < numbers_count; i++)
+		{
+		ctx->root_numbers[i] = numbers[i];
+		ctx->numbers[i] = numbers[i];
+		}
+	ctx->root_count = numbers_count;
+	if (steps == NULL)
+		steps_stack_init(&ctx->root_steps);
+	else
+		steps_stack_copy(&ctx->root_steps, steps);
+	ctx->depth = 0;
+	}
+
+// Start filling stats (if not NULL) with the search of ctx
+static void search_stats_begin(SearchContext* ctx, SearchStats* stats)
+	{
+	if (stats == NULL)
+		return;
+	memset(stats, 0, sizeof(SearchStats));
+	stats->first_exact_ns = -1;
+#ifdef CIFRAS_STATS
+	stats->enabled = true;
+#endif
+	ctx->stats = stats;
+	ctx->start_ns = now_ns();
+	}
+
+// Wrappers
 void resolve_cifras(const long int* numbers, int target, SolutionStepStack* best_steps)
 	{
-	SolutionStepStack current_steps;
+	resolve_cifras_n(numbers, NUM_COUNT, target, best_steps);
+	}
+
+void resolve_cifras_n(const long int* numbers, int numbers_count, int target,
+	SolutionStepStack* best_steps)
+	{
+	SearchContext ctx;
 	
 	assert(numbers != NULL);
+	assert(numbers_count >= MIN_NUM_COUNT && numbers_count <= MAX_NUM_COUNT);
 	assert(target >= 0);
 	assert(best_steps != NULL);
 	
-	steps_stack_init(&current_steps);
 	steps_stack_init(best_steps);
+	search_context_init(&ctx, target, best_steps, numbers, numbers_count, NULL);
 	
-	cifras_bt(numbers, NUM_COUNT, target, &current_steps, best_steps);
+	cifras_bt(&ctx, numbers_count, -1, NULL);
+	}
+
+bool cifras_engine_from_name(const char* name, CifrasEngine* engine)
+	{
+	static const struct
+		{
+		const char* name;
+		CifrasEngine engine;
+		} ENGINES[] =
+		{
+		{"bt", CIFRAS_ENGINE_BT},
+		{"dp", CIFRAS_ENGINE_DP},
+		{"id", CIFRAS_ENGINE_ID},
+		{"iter", CIFRAS_ENGINE_ITER},
+		{"auto", CIFRAS_ENGINE_AUTO},
+		};
+	size_t i;
+
+	assert(name != NULL);
+	assert(engine != NULL);
+
+	for (i = 0; i < sizeof(ENGINES) / sizeof(ENGINES[0]); i++)
+		if (strcmp(ENGINES[i].name, name) == 0)
+			{
+			*engine = ENGINES[i].engine;
+			return true;
+			}
+	return false;
+	}
+
+void resolve_cifras_engine(const long int* numbers, int numbers_count,
+	int target, SolutionStepStack* best_steps, CifrasEngine engine)
+	{
+	if (engine == CIFRAS_ENGINE_AUTO)
+		engine = numbers_count >= CIFRAS_AUTO_DP_MIN_COUNT ? CIFRAS_ENGINE_DP :
+			CIFRAS_ENGINE_BT;
+	if (engine == CIFRAS_ENGINE_DP)
+		resolve_cifras_dp(numbers, numbers_count, target, best_steps);
+	else if (engine == CIFRAS_ENGINE_ID)
+		resolve_cifras_deepening(numbers, numbers_count, target, best_steps,
+			NULL);
+	else if (engine == CIFRAS_ENGINE_ITER)
+		resolve_cifras_iterative(numbers, numbers_count, target, best_steps);
+	else
+		resolve_cifras_n(numbers, numbers_count, target, best_steps);
+	}
+
+void resolve_cifras_bounds(const long int* numbers, int numbers_count,
+	int target, SolutionStepStack* best_steps, unsigned bounds,
+	SearchStats* stats)
+	{
+	SearchContext ctx;
+	
+	assert(numbers != NULL);
+	assert(numbers_count >= MIN_NUM_COUNT && numbers_count <= MAX_NUM_COUNT);
+	assert(target >= 0);
+	assert(best_steps != NULL);
+	
+	steps_stack_init(best_steps);
+	search_context_init(&ctx, target, best_steps, numbers, numbers_count, NULL);
+	ctx.bounds = bounds;
+	search_stats_begin(&ctx, stats);
+	
+	cifras_bt(&ctx, numbers_count, -1, NULL);
+	if (stats != NULL)
+		stats->total_ns = now_ns() - ctx.start_ns;
+	}
+
+void resolve_cifras_stats(const long int* numbers, int target,
+	SolutionStepStack* best_steps, SearchStats* stats)
+	{
+	assert(stats != NULL);
+	resolve_cifras_bounds(numbers, NUM_COUNT, target, best_steps,
+		CIFRAS_BOUNDS_DEFAULT, stats);
+	}
+
+bool resolve_cifras_budget(const long int* numbers, int target,
+	SolutionStepStack* best_steps, uint64_t deadline_ns,
+	CifrasProgressFn callback, void* arg)
+	{
+	SearchContext ctx;
+	
+	assert(numbers != NULL);
+	assert(target >= 0);
+	assert(best_steps != NULL);
+	
+	steps_stack_init(best_steps);
+	search_context_init(&ctx, target, best_steps, numbers, NUM_COUNT, NULL);
+	ctx.progress = callback;
+	ctx.progress_arg = arg;
+	
+	search_greedy(&ctx, NUM_COUNT);
+	ctx.deadline_ns = deadline_ns;
+	cifras_bt(&ctx, NUM_COUNT, -1, NULL);
+	return ctx.stopped == false;
+	}
+
+void resolve_cifras_deepening(const long int* numbers, int numbers_count,
+	int target, SolutionStepStack* best_steps, SearchStats* stats)
+	{
+	DeepeningLevel levels[DEEPENING_CACHE_DEPTH + 1];
+	SearchContext ctx;
+	bool allocated = true;
+	int depth;
+	
+	assert(numbers != NULL);
+	assert(numbers_count >= MIN_NUM_COUNT && numbers_count <= MAX_NUM_COUNT);
+	assert(target >= 0);
+	assert(best_steps != NULL);
+	assert(numbers_count > DEEPENING_CACHE_DEPTH + 1);
+	
+	for (depth = 0; depth <= DEEPENING_CACHE_DEPTH; depth++)
+		allocated = deepening_level_init(&levels[depth], numbers_count,
+			depth) && allocated;
+	if (allocated == false)
+		{
+		for (depth = 0; depth <= DEEPENING_CACHE_DEPTH; depth++)
+			deepening_level_free(&levels[depth]);
+		resolve_cifras_bounds(numbers, numbers_count, target, best_steps,
+			CIFRAS_BOUNDS_DEFAULT, stats);
+		return;
+		}
+	
+	steps_stack_init(best_steps);
+	search_context_init(&ctx, target, best_steps, numbers, numbers_count, NULL);
+	search_stats_begin(&ctx, stats);
+	
+	// Passes of the cached depths: one level of distinct states from the
+	// previous one
+	memcpy(levels[0].states[0].numbers, numbers,
+		sizeof(long int) * numbers_count);
+	levels[0].count = 1;
+	for (depth = 1; depth <= DEEPENING_CACHE_DEPTH &&
+		(ctx.best >> BEST_KEY_COUNT_BITS) != 0; depth++)
+		deepening_expand(&ctx, &levels[depth - 1], numbers_count - depth + 1,
+			depth, &levels[depth]);
+	
+	// The next pass only needs the results of the last level, not its
+	// states
+	if ((ctx.best >> BEST_KEY_COUNT_BITS) != 0)
+		deepening_expand(&ctx, &levels[DEEPENING_CACHE_DEPTH],
+			numbers_count - DEEPENING_CACHE_DEPTH, DEEPENING_CACHE_DEPTH + 1,
+			NULL);
+	
+	// Deeper passes: depth-limited cifras_bt from every state of the last
+	// level
+	for (depth = DEEPENING_CACHE_DEPTH + 2; depth < numbers_count - 2 &&
+		(ctx.best >> BEST_KEY_COUNT_BITS) != 0; depth++)
+		deepening_search(&ctx, &levels[DEEPENING_CACHE_DEPTH],
+			numbers_count - DEEPENING_CACHE_DEPTH, depth, depth);
+	// The last pass takes the two deepest depths at once, so the leaf kernel
+	// solves its nodes of 3 numbers. An exact solution of the deepest depth
+	// may come first; the bounds then keep looking for a shorter one
+	if (depth < numbers_count && (ctx.best >> BEST_KEY_COUNT_BITS) != 0)
+		deepening_search(&ctx, &levels[DEEPENING_CACHE_DEPTH],
+			numbers_count - DEEPENING_CACHE_DEPTH, depth, numbers_count - 1);
+	
+	for (depth = 0; depth <= DEEPENING_CACHE_DEPTH; depth++)
+		deepening_level_free(&levels[depth]);
+	if (stats != NULL)
+		stats->total_ns = now_ns() - ctx.start_ns;
+	}
+
+void resolve_cifras_tt(const long int* numbers, int target,
+	SolutionStepStack* best_steps, TranspositionTable* tt)
+	{
+	SearchContext ctx;
+	
+	assert(numbers != NULL);
+	assert(target >= 0);
+	assert(best_steps != NULL);
+	assert(tt != NULL);
+	
+	steps_stack_init(best_steps);
+	transposition_table_new_search(tt);
+	search_context_init(&ctx, target, best_steps, numbers, NUM_COUNT, NULL);
+	ctx.tt = tt;
+	
+	cifras_bt(&ctx, NUM_COUNT, -1, NULL);
+	}
+
+// Resumable search (CifrasSearch).
+//
+// Every iteration of cifras_search_loop does one step of the node on top of
+// the stack: try the next operation of its current pair, move to the next
+// pair or pop the node once it has no pairs left. Children are checked by
+// cifras_search_enter before they are pushed, in the same order as
+// cifras_bt_node, so the search visits the same nodes and finds the same
+// solution. Between two iterations the whole state is in the frames, so the
+// loop can stop after any of them.
+//
+// Every frame holds its own copy of the numbers (instead of replacing and
+// restoring them in place), so a frame can be handed over to another search
+// as it is.
+
+// Rebuild best_steps from the first count codes of the path
+static void cifras_search_record(CifrasSearch* search, int count,
+	unsigned long long key)
+	{
+	steps_stack_init(&search->best_steps);
+	steps_stack_from_codes(&search->best_steps, search->root_numbers,
+		search->root_count, search->codes, count);
+	search->best = key;
+	}
+
+// Point frame (numbers_count numbers) to the pair of rank pair, skipping its
+// operations if the pair repeats values (repeated_operand)
+static void cifras_search_seek(CifrasSearchFrame* frame, int numbers_count,
+	int pair)
+	{
+	int i = 0, j = 1, k;
+	
+	for (k = 0; k < pair; k++)
+		if (++j == numbers_count)
+			{
+			i++;
+			j = i + 1;
+			}
+	frame->i = i;
+	frame->j = j;
+	frame->pair = pair;
+	frame->op = repeated_operand(frame->numbers, 0, i) ||
+		repeated_operand(frame->numbers, i + 1, j) ? -1 : 3;
+	}
+
+// Visit the node of frame depth, as cifras_bt_node does before its loops:
+// compare its last result with the best, then apply the bounds and the leaf
+// kernel. Return true if its children must be searched
+static inline __attribute__((always_inline)) bool cifras_search_enter(
+	CifrasSearch* search, int depth, const bool wide)
+	{
+	CifrasSearchFrame* frame = &search->frames[depth];
+	int numbers_count = search->root_count - depth;
+	unsigned long long key;
+	int count;
+	
+	search->nodes++;
+	if (frame->last_pos >= 0)
+		{
+		key = search_key(wide, frame->numbers[frame->last_pos], search->target,
+			depth);
+		if (key < search->best)
+			cifras_search_record(search, depth, key);
+		}
+	if (numbers_count == 1 ||
+		prunable_length(depth, search->best) ||
+		prunable_step_count(depth, search->best) ||
+		prunable_upper_value(frame->numbers, numbers_count, search->target,
+		search->best))
+		return false;
+	if (numbers_count == 3 && search->leaf_kernel &&
+		leaf_kernel_fits(frame->numbers, search->target))
+		{
+		if (leaf_kernel_best(frame->numbers, search->target, depth,
+			search->best, &key, &search->codes[depth], &count))
+			cifras_search_record(search, depth + count, key);
+		return false;
+		}
+	
+	frame->end_pair = numbers_count * (numbers_count - 1) / 2;
+	cifras_search_seek(frame, numbers_count, 0);
+	return true;
+	}
+
+// wide: search->wide, as a constant (see cifras_bt_node)
+static inline __attribute__((always_inline)) bool cifras_search_loop(
+	CifrasSearch* search, unsigned long long max_nodes, const bool wide)
+	{
+	CifrasSearchFrame* frame;
+	CifrasSearchFrame* child;
+	SolutionStep candidate;
+	unsigned long long key, last_node;
+	int depth, numbers_count, op;
+	
+	last_node = max_nodes > ULLONG_MAX - search->nodes ? ULLONG_MAX :
+		search->nodes + max_nodes;
+	while (search->depth >= 0 && search->nodes < last_node)
+		{
+		depth = search->depth;
+		frame = &search->frames[depth];
+		numbers_count = search->root_count - depth;
+		
+		// Pair done: next pair or pop
+		if (frame->op < 0)
+			{
+			if (frame->pair + 1 >= frame->end_pair)
+				search->depth--;
+			else
+				cifras_search_seek(frame, numbers_count, frame->pair + 1);
+			continue;
+			}
+		
+		op = frame->op--;
+		if (search_candidate(wide, &candidate, frame->numbers[frame->i],
+			frame->numbers[frame->j], op) == false)
+			continue;
+		// Commutativity prune (steps_out_of_order), as in cifras_bt_node
+		if (frame->last_pos >= 0 && frame->i != frame->last_pos &&
+			frame->j != frame->last_pos &&
+			steps_out_of_order(&frame->last_step, &candidate))
+			continue;
+		search->codes[depth] = step_code(frame->i, frame->j, op);
+		
+		// A child of 1 number is only compared with the best
+		if (numbers_count == 2)
+			{
+			search->nodes++;
+			key = search_key(wide, candidate.result, search->target,
+				depth + 1);
+			if (key < search->best)
+				cifras_search_record(search, depth + 1, key);
+			continue;
+			}
+		
+		// Whole array: a constant size copy is cheaper
+		child = &search->frames[depth + 1];
+		memcpy(child->numbers, frame->numbers, sizeof(child->numbers));
+		numbers_replace_pair(child->numbers, numbers_count, frame->i,
+			frame->j, candidate.result);
+		child->last_step = candidate;
+		child->last_pos = frame->i;
+		if (cifras_search_enter(search, depth + 1, wide))
+			search->depth = depth + 1;
+		}
+	return search->depth < 0;
+	}
+
+void cifras_search_init(CifrasSearch* search, const long int* numbers,
+	int numbers_count, int target)
+	{
+	assert(search != NULL);
+	assert(numbers != NULL);
+	assert(numbers_count >= MIN_NUM_COUNT && numbers_count <= MAX_NUM_COUNT);
+	assert(target >= 0);
+	
+	search->target = target;
+	memcpy(search->root_numbers, numbers, sizeof(long int) * numbers_count);
+	search->root_count = numbers_count;
+	search->best = BEST_KEY_EMPTY;
+	steps_stack_init(&search->best_steps);
+	search->wide = numbers_are_narrow(numbers, numbers_count) == false;
+	search->leaf_kernel = leaf_kernel_available();
+	search->nodes = 0;
+	memcpy(search->frames[0].numbers, numbers,
+		sizeof(long int) * numbers_count);
+	search->frames[0].last_pos = -1;
+	if (search->wide)
+		search->depth = cifras_search_enter(search, 0, true) ? 0 : -1;
+	else
+		search->depth = cifras_search_enter(search, 0, false) ? 0 : -1;
+	}
+
+bool cifras_search_run(CifrasSearch* search, unsigned long long max_nodes)
+	{
+	assert(search != NULL);
+	if (search->wide)
+		return cifras_search_loop(search, max_nodes, true);
+	return cifras_search_loop(search, max_nodes, false);
+	}
+
+bool cifras_search_split(CifrasSearch* search, CifrasSearch* thief)
+	{
+	CifrasSearchFrame* frame;
+	int depth, first, middle, k;
+	
+	assert(search != NULL);
+	assert(thief != NULL);
+	
+	// The shallowest pending pairs hold the largest subtrees
+	for (depth = 0; depth <= search->depth; depth++)
+		{
+		frame = &search->frames[depth];
+		// Pairs not started yet
+		first = frame->pair + 1;
+		if (first < frame->end_pair)
+			break;
+		}
+	if (depth > search->depth)
+		return false;
+	middle = first + (frame->end_pair - first) / 2;
+	
+	// The thief keeps the path down to the frame, with nothing left to do
+	// above it, and takes the pairs from middle to end_pair
+	*thief = *search;
+	thief->nodes = 0;
+	thief->depth = depth;
+	for (k = 0; k < depth; k++)
+		{
+		thief->frames[k].op = -1;
+		thief->frames[k].end_pair = thief->frames[k].pair + 1;
+		}
+	cifras_search_seek(&thief->frames[depth], search->root_count - depth,
+		middle);
+	frame->end_pair = middle;
+	return true;
+	}
+
+void cifras_search_merge(CifrasSearch* search, const CifrasSearch* other)
+	{
+	assert(search != NULL);
+	assert(other != NULL);
+	assert(search->target == other->target &&
+		search->root_count == other->root_count);
+	
+	if (other->best < search->best)
+		{
+		search->best = other->best;
+		steps_stack_copy(&search->best_steps, &other->best_steps);
+		}
+	}
+
+void cifras_search_best(const CifrasSearch* search,
+	SolutionStepStack* best_steps)
+	{
+	assert(search != NULL);
+	assert(best_steps != NULL);
+	steps_stack_copy(best_steps, &search->best_steps);
+	}
+
+void resolve_cifras_iterative(const long int* numbers, int numbers_count,
+	int target, SolutionStepStack* best_steps)
+	{
+	CifrasSearch search;
+	
+	assert(best_steps != NULL);
+	cifras_search_init(&search, numbers, numbers_count, target);
+	cifras_search_run(&search, ULLONG_MAX);
+	cifras_search_best(&search, best_steps);
+	}
+
+// Multithreaded version.
+//
+// The first MT_SPLIT_DEPTH levels of the recursion are expanded here and
+// every node reached at that depth becomes a task (up to 60 tasks for 1 level
+// and 2400 for 2 with NUM_COUNT == 6). The tasks run in a work-stealing pool
+// (work_pool.h), every worker with its own best_steps. The best key is shared
+// by all of them, so a solution found by one thread prunes the branches of
+// the rest.
+//
+// The result is as good as the one of resolve_cifras (same result and steps
+// count), although the steps may differ if there are several solutions
+// equally good
+
+typedef struct
+	{
+	long int numbers[MAX_NUM_COUNT];
+	int numbers_count;
+	SolutionStepStack steps;
+	} SplitTask;
+
+typedef struct
+	{
+	SplitTask* tasks;
+	size_t count;
+	SolutionStepStack* worker_best;
+	int target;
+	_Atomic unsigned long long shared_best;
+	} SplitJob;
+
+// Expand the tree until depth levels below numbers and append the nodes
+// found there to job->tasks. The shallower nodes are candidates to be the
+// best solution, so they are checked against ctx->best_steps
+static void split_tasks(const long int* numbers, int numbers_count,
+	SolutionStepStack* current_steps, int depth, SplitJob* job,
+	const SearchContext* ctx)
+	{
+	int i, j, op;
+	SolutionStep candidate;
+	long int next_numbers[MAX_NUM_COUNT];
+	SplitTask* task;
+
+	if (depth == 0 || numbers_count == 1)
+		{
+		task = &job->tasks[job->count++];
+		for (i = 0; i < numbers_count; i++)
+			task->numbers[i] = numbers[i];
+		task->numbers_count = numbers_count;
+		steps_stack_copy(&task->steps, current_steps);
+		return;
+		}
+
+	if (steps_stack_compare(current_steps, ctx->best_steps, ctx->target) == -1)
+		steps_stack_copy(ctx->best_steps, current_steps);
+
+	for (i = 0; i < numbers_count; i++)
+		for (j = i + 1; j < numbers_count; j++)
+			{
+			// Same order as popping the stack of build_candidates_stack
+			for (op = 3; op >= 0; op--)
+				{
+				if (build_candidate_wide(&candidate, numbers[i], numbers[j],
+					op) == false)
+					continue;
+				steps_stack_push(current_steps, &candidate);
+				build_next_numbers(next_numbers, numbers, numbers_count, i, j,
+					candidate.result);
+				split_tasks(next_numbers, numbers_count - 1, current_steps,
+					depth - 1, job, ctx);
+				steps_stack_pop(current_steps, NULL);
+				}
+			}
+	}
+
+static void split_task_run(void* arg, size_t task_index, int worker_id)
+	{
+	SplitJob* job = arg;
+	const SplitTask* task = &job->tasks[task_index];
+	SearchContext ctx;
+
+	search_context_init(&ctx, job->target, &job->worker_best[worker_id],
+		task->numbers, task->numbers_count, &task->steps);
+	ctx.shared_best = &job->shared_best;
+	// build_next_numbers leaves the result of the last step in numbers[0]
+	if (steps_stack_is_empty(&task->steps))
+		cifras_bt(&ctx, task->numbers_count, -1, NULL);
+	else
+		cifras_bt(&ctx, task->numbers_count, 0,
+			&task->steps.steps[steps_stack_count(&task->steps) - 1]);
+	}
+
+void resolve_cifras_mt(const long int* numbers, int target,
+	SolutionStepStack* best_steps, int nthreads)
+	{
+	resolve_cifras_mt_n(numbers, NUM_COUNT, target, best_steps, nthreads);
+	}
+
+void resolve_cifras_mt_n(const long int* numbers, int numbers_count, int target,
+	SolutionStepStack* best_steps, int nthreads)
+	{
+	SplitJob job;
+	SolutionStepStack current_steps;
+	SearchContext ctx;
+	size_t max_tasks = 1;
+	int depth, n, i;
+
+	assert(numbers != NULL);
+	assert(numbers_count >= MIN_NUM_COUNT && numbers_count <= MAX_NUM_COUNT);
+	assert(target >= 0);
+	assert(best_steps != NULL);
+
+	if (nthreads <= 0)
+		nthreads = work_pool_default_threads();
+	if (nthreads == 1)
+		{
+		resolve_cifras_n(numbers, numbers_count, target, best_steps);
+		return;
+		}
+
+	// Upper bound of the number of tasks: pairs * 4 operations per level
+	depth = MT_SPLIT_DEPTH < numbers_count - 1 ? MT_SPLIT_DEPTH : numbers_count - 1;
+	for (n = numbers_count; n > numbers_count - depth; n--)
+		max_tasks *= (size_t)(n * (n - 1) / 2) * 4;
+
+	job.tasks = malloc(sizeof(SplitTask) * max_tasks);
+	job.worker_best = malloc(sizeof(SolutionStepStack) * nthreads);
+	if (job.tasks == NULL || job.worker_best == NULL)
+		{
+		free(job.tasks);
+		free(job.worker_best);
+		resolve_cifras_n(numbers, numbers_count, target, best_steps);
+		return;
+		}
+	job.count = 0;
+	job.target = target;
+	for (i = 0; i < nthreads; i++)
+		steps_stack_init(&job.worker_best[i]);
+
+	// Build the tasks. The best solution among the shallow nodes seeds the
+	// shared key
+	steps_stack_init(&current_steps);
+	steps_stack_init(best_steps);
+	search_context_init(&ctx, target, best_steps, numbers, numbers_count, NULL);
+	split_tasks(numbers, numbers_count, &current_steps, depth, &job, &ctx);
+	assert(job.count <= max_tasks);
+	atomic_init(&job.shared_best, best_key(best_steps, target));
+
+	if (work_pool_run(job.count, nthreads, split_task_run, &job) != 0)
+		for (i = 0; (size_t)i < job.count; i++)
+			split_task_run(&job, i, 0);
+
+	// Merge the best solutions of the workers
+	for (i = 0; i < nthreads; i++)
+		if (steps_stack_compare(&job.worker_best[i], best_steps, target) == -1)
+			steps_stack_copy(best_steps, &job.worker_best[i]);
+
+	free(job.tasks);
+	free(job.worker_best);
 	}
 
 
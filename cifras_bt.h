@@ -4,12 +4,27 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
+// Numbers of the classic game. The solvers also accept games with
+// MIN_NUM_COUNT to MAX_NUM_COUNT numbers (resolve_cifras_n)
 #define NUM_COUNT 6
+#define MIN_NUM_COUNT 4
+#define MAX_NUM_COUNT 8
+// Valid ranges for the numbers and the target of a game
+#define MIN_NUMBER 1
+#define MAX_NUMBER 100
+#define MIN_TARGET 100
+#define MAX_TARGET 999
+// Valid ranges of the wide games (variants with bigger numbers and targets).
+// The solvers accept any numbers and target, these only bound the input
+#define WIDE_MAX_NUMBER 999999999
+#define WIDE_MIN_TARGET 1
+#define WIDE_MAX_TARGET 999999999
 // MAX_SOLUTION_STEPS must be at least 4 because the internal function 
 // build_candidates_stack uses it
-#if NUM_COUNT > 4
-	#define MAX_SOLUTION_STEPS (NUM_COUNT - 1)
+#if MAX_NUM_COUNT > 4
+	#define MAX_SOLUTION_STEPS (MAX_NUM_COUNT - 1)
 #else
 	#define MAX_SOLUTION_STEPS 4
 #endif
@@ -17,6 +32,10 @@
 // Type long int used because, for combinations of numbers relatively high,
 // INT_MAX is overstepped. For example this one:
 // 100, 100, 100, 25, 10, 9
+// With MAX_NUM_COUNT numbers up to MAX_NUMBER every value stays below
+// 100^8 = 10^16, far from LONG_MAX on 64-bit systems. Wide games can go
+// beyond LONG_MAX: the solvers check their additions and multiplications and
+// skip the steps whose result does not fit in a long int
 typedef struct 
 	{
 	long int result;
@@ -74,6 +93,214 @@ static inline long int steps_stack_result(const SolutionStepStack* stack)
 	return stack->steps[stack->count - 1].result;
 	}
 void steps_stack_copy(SolutionStepStack* target, const SolutionStepStack* source);
+
+// Search instrumentation filled by resolve_cifras_stats.
+// The counters are only updated when compiled with -DCIFRAS_STATS (benchmark
+// build). Otherwise they compile down to nothing and enabled is false
+typedef struct
+	{
+	bool enabled;
+	// Nodes visited per depth (steps done). nodes[0] is the root
+	unsigned long long nodes[MAX_NUM_COUNT];
+	// Subtrees cut by prunable_length
+	unsigned long long pruned_length;
+	// Subtrees cut by prunable_upper_value
+	unsigned long long pruned_upper_value;
+	// Subtrees cut by prunable_step_count
+	unsigned long long pruned_step_count;
+	// Subtrees cut by prunable_depth_value
+	unsigned long long pruned_depth_value;
+	// Pairs whose multiplication and division are skipped because an
+	// operand is 1 (build_candidates_stack)
+	unsigned long long pruned_operand_one;
+	// Pairs of repeated operands and steps out of the canonical order
+	unsigned long long pruned_symmetry;
+	// Subtrees cut by the transposition table
+	unsigned long long pruned_transposition;
+	// steps_stack_copy calls into best_steps
+	unsigned long long best_copies;
+	// Nodes of 3 numbers solved by the leaf kernel (cifras_leaf.h). The
+	// nodes below them are not counted in nodes
+	unsigned long long leaf_kernels;
+	// Since the beginning of the search. first_exact_ns is -1 if the target
+	// was not reached
+	double first_exact_ns;
+	double total_ns;
+	} SearchStats;
+
+// Bounds of cifras_bt (resolve_cifras_bounds). Each one cuts subtrees that
+// provably cannot hold a better solution, so any combination gives the same
+// result distance and steps count; they only change the nodes visited.
+// Exact result already found and the node has at least as many steps
+#define CIFRAS_BOUND_LENGTH (1u << 0)
+// The product of the pending numbers (1 counted as 2) is too far below the
+// target
+#define CIFRAS_BOUND_UPPER_VALUE (1u << 1)
+// Exact result already found and every child would have at least as many
+// steps
+#define CIFRAS_BOUND_STEP_COUNT (1u << 2)
+// CIFRAS_BOUND_UPPER_VALUE taking into account how many steps are left
+// before a solution stops being better on steps count
+#define CIFRAS_BOUND_DEPTH_VALUE (1u << 3)
+#define CIFRAS_BOUNDS_ALL (CIFRAS_BOUND_LENGTH | CIFRAS_BOUND_UPPER_VALUE | \
+	CIFRAS_BOUND_STEP_COUNT | CIFRAS_BOUND_DEPTH_VALUE)
+// Bounds of resolve_cifras. CIFRAS_BOUND_DEPTH_VALUE cuts some more nodes but
+// costs more than it saves on the benchmark corpus
+#define CIFRAS_BOUNDS_DEFAULT (CIFRAS_BOUND_LENGTH | CIFRAS_BOUND_UPPER_VALUE | \
+	CIFRAS_BOUND_STEP_COUNT)
+
+// Search engines of resolve_cifras_engine. All return a solution with the
+// same result distance and steps count
+typedef enum
+	{
+	// Backtracking over sequences of steps (cifras_bt)
+	CIFRAS_ENGINE_BT,
+	// Bottom-up dynamic programming over subsets of the numbers (cifras_dp.h).
+	// Much faster when the target cannot be reached
+	CIFRAS_ENGINE_DP,
+	// Iterative deepening over cifras_bt (resolve_cifras_deepening). Much
+	// faster when the target can be reached in a few steps
+	CIFRAS_ENGINE_ID,
+	// Same search as cifras_bt with an explicit stack (CifrasSearch)
+	CIFRAS_ENGINE_ITER,
+	// The fastest engine for the count of numbers: dp from
+	// CIFRAS_AUTO_DP_MIN_COUNT numbers on, where its cost does not depend on
+	// how near the target the numbers get, and bt below
+	CIFRAS_ENGINE_AUTO
+	} CifrasEngine;
+
+#define CIFRAS_AUTO_DP_MIN_COUNT 6
+
+// Names of the engines (the value of --engine), for usage messages
+#define CIFRAS_ENGINE_NAMES "bt|dp|id|iter|auto"
+// Engine called name (one of CIFRAS_ENGINE_NAMES). Return false if there is
+// none
+bool cifras_engine_from_name(const char* name, CifrasEngine* engine);
+
 void resolve_cifras(const long int* numbers, int target, SolutionStepStack* best_steps);
+// resolve_cifras for a game of numbers_count numbers
+// (MIN_NUM_COUNT <= numbers_count <= MAX_NUM_COUNT)
+void resolve_cifras_n(const long int* numbers, int numbers_count, int target,
+	SolutionStepStack* best_steps);
+// resolve_cifras_n with the given engine
+void resolve_cifras_engine(const long int* numbers, int numbers_count,
+	int target, SolutionStepStack* best_steps, CifrasEngine engine);
+// resolve_cifras_n with the set of bounds bounds (CIFRAS_BOUND_*) instead of
+// CIFRAS_BOUNDS_DEFAULT. stats is filled if not NULL (see SearchStats)
+void resolve_cifras_bounds(const long int* numbers, int numbers_count,
+	int target, SolutionStepStack* best_steps, unsigned bounds,
+	SearchStats* stats);
+// resolve_cifras filling stats (see SearchStats)
+void resolve_cifras_stats(const long int* numbers, int target,
+	SolutionStepStack* best_steps, SearchStats* stats);
+// resolve_cifras_n by iterative deepening: search every solution of 1 step,
+// then of 2 steps and so on, and stop at the first depth that reaches the
+// target. Unlike the depth-first order of cifras_bt, the first exact
+// solution found is already the shortest one.
+// The distinct multisets of numbers reached with the first steps are cached
+// per depth, so each pass starts from the states of the previous ones
+// instead of the root. stats is filled if not NULL (see SearchStats)
+void resolve_cifras_deepening(const long int* numbers, int numbers_count,
+	int target, SolutionStepStack* best_steps, SearchStats* stats);
+
+// Called by resolve_cifras_budget with every better solution, as soon as it
+// is found. arg is the one given to resolve_cifras_budget
+typedef void (*CifrasProgressFn)(const SolutionStepStack* best_steps,
+	void* arg);
+
+// Anytime version of resolve_cifras. A greedy pass gives a first solution in
+// microseconds, then the search runs until it finishes or the clock of
+// cifras_now_ns reaches deadline_ns (0 means no deadline), and best_steps
+// holds the best solution found so far.
+// callback (NULL if not used) receives the greedy solution and every
+// improvement.
+// Return true if best_steps is proven optimal (the search finished)
+bool resolve_cifras_budget(const long int* numbers, int target,
+	SolutionStepStack* best_steps, uint64_t deadline_ns,
+	CifrasProgressFn callback, void* arg);
+// Monotonic clock of resolve_cifras_budget, in nanoseconds
+uint64_t cifras_now_ns(void);
+
+// Resumable search: the backtracking of cifras_bt (same order of the steps
+// and same bounds, so the same solution) with its state in an explicit stack
+// of frames instead of the C stack. A search can be run a few nodes at a
+// time, moved to another thread between two runs and split: a part of its
+// pending subtrees is given away to another search. The solution of a split
+// game is the best of the solutions of its searches (cifras_search_merge).
+// A CifrasSearch does not own any memory, so it can be copied or dropped at
+// any moment.
+
+// Node of the path from the root to the current one
+typedef struct
+	{
+	// Pending numbers (root_count - depth of the frame)
+	long int numbers[MAX_NUM_COUNT];
+	// Step that reached the node and position of its result in numbers.
+	// last_pos is -1 at the root
+	SolutionStep last_step;
+	int last_pos;
+	// Next step to try: pair of numbers (i, j), its rank among the pairs of
+	// the node (same order as the loops of cifras_bt) and operation (3 down
+	// to 0, -1 once the pair is done)
+	int i;
+	int j;
+	int pair;
+	int op;
+	// Pairs from end_pair onwards belong to another search
+	int end_pair;
+	} CifrasSearchFrame;
+
+typedef struct
+	{
+	int target;
+	long int root_numbers[MAX_NUM_COUNT];
+	int root_count;
+	// Key of best_steps (see cifras_bt.c)
+	unsigned long long best;
+	SolutionStepStack best_steps;
+	// The values may overflow (see SearchContext in cifras_bt.c)
+	bool wide;
+	bool leaf_kernel;
+	// frames[0..depth] is the current path, codes[k] the step_code of the
+	// step tried by frames[k]. depth is -1 once the search is finished
+	CifrasSearchFrame frames[MAX_NUM_COUNT];
+	uint8_t codes[MAX_SOLUTION_STEPS];
+	int depth;
+	// Nodes visited by the search
+	unsigned long long nodes;
+	} CifrasSearch;
+
+// Start the search of a game (MIN_NUM_COUNT <= numbers_count <= MAX_NUM_COUNT)
+void cifras_search_init(CifrasSearch* search, const long int* numbers,
+	int numbers_count, int target);
+// Go on with the search for max_nodes nodes at most (ULLONG_MAX: until it
+// finishes). Return true if the search is finished
+bool cifras_search_run(CifrasSearch* search, unsigned long long max_nodes);
+static inline bool cifras_search_done(const CifrasSearch* search)
+	{
+	assert(search != NULL);
+	return search->depth < 0;
+	}
+// Give about half of the pending pairs of the shallowest node that has any
+// to thief, which becomes a search of those subtrees only (and starts with
+// the best solution of search). Return false if there is nothing to give
+bool cifras_search_split(CifrasSearch* search, CifrasSearch* thief);
+// Take the best solution of other if it is better. other must search the
+// same game (for example a search split from this one). It can be called at
+// any moment: a better solution prunes more nodes
+void cifras_search_merge(CifrasSearch* search, const CifrasSearch* other);
+// Best solution found so far (the solution once the search is finished)
+void cifras_search_best(const CifrasSearch* search,
+	SolutionStepStack* best_steps);
+// resolve_cifras_n run by a CifrasSearch (CIFRAS_ENGINE_ITER)
+void resolve_cifras_iterative(const long int* numbers, int numbers_count,
+	int target, SolutionStepStack* best_steps);
+
+// Same as resolve_cifras but splitting the search among nthreads threads.
+// nthreads <= 0 means one thread per online CPU
+void resolve_cifras_mt(const long int* numbers, int target,
+	SolutionStepStack* best_steps, int nthreads);
+void resolve_cifras_mt_n(const long int* numbers, int numbers_count, int target,
+	SolutionStepStack* best_steps, int nthreads);
 
 #endif
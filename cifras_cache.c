@@ -0,0 +1,263 @@
+#include "cifras_cache.h"
+#include "cifras_ops.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+	{
+	uint64_t numbers;
+	int32_t target;
+	uint8_t numbers_count;
+	} CacheKey;
+
+static int op_index(char op)
+	{
+	switch (op)
+		{
+		case '+': return 0;
+		case '-': return 1;
+		case '*': return 2;
+		default:
+			assert(op == '/');
+			return 3;
+		}
+	}
+
+// Codes (step_code) of steps replayed over the numbers_count first numbers.
+// The operands are matched by value, so the numbers can be in any order
+static void steps_codes(const long int* numbers, int numbers_count,
+	const SolutionStepStack* steps, uint8_t* codes)
+	{
+	long int current[MAX_NUM_COUNT];
+	const SolutionStep* step;
+	int k, i, j, count;
+
+	memcpy(current, numbers, sizeof(long int) * numbers_count);
+	for (k = 0; k < steps_stack_count(steps); k++)
+		{
+		step = &steps->steps[k];
+		count = numbers_count - k;
+		for (i = 0; i < count; i++)
+			{
+			if (current[i] != step->a && current[i] != step->b)
+				continue;
+			for (j = i + 1; j < count; j++)
+				if ((current[i] == step->a && current[j] == step->b) ||
+					(current[i] == step->b && current[j] == step->a))
+					break;
+			if (j < count)
+				break;
+			}
+		assert(i < count);
+		codes[k] = step_code(i, j, op_index(step->op));
+		numbers_replace_pair(current, count, i, j, step->result);
+		}
+	}
+
+// Sort the numbers into the key. Return false if they cannot be cached
+static bool cache_key(CacheKey* key, long int* sorted, const long int* numbers,
+	int numbers_count, int target)
+	{
+	long int value;
+	int i, j;
+
+	assert(numbers_count >= MIN_NUM_COUNT && numbers_count <= MAX_NUM_COUNT);
+	for (i = 0; i < numbers_count; i++)
+		{
+		value = numbers[i];
+		if (value < MIN_NUMBER || value > MAX_NUMBER)
+			return false;
+		for (j = i; j > 0 && sorted[j - 1] > value; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = value;
+		}
+	key->numbers = 0;
+	for (i = 0; i < numbers_count; i++)
+		key->numbers |= (uint64_t)sorted[i] << (8 * i);
+	key->target = target;
+	key->numbers_count = (uint8_t)numbers_count;
+	return true;
+	}
+
+static inline size_t cache_set(const CifrasCache* cache, const CacheKey* key)
+	{
+	uint64_t hash;
+
+	hash = (key->numbers ^ ((uint64_t)(uint32_t)key->target << 32 |
+		key->numbers_count)) * 0x9E3779B97F4A7C15ULL;
+	hash ^= hash >> 29;
+	hash *= 0xBF58476D1CE4E5B9ULL;
+	hash ^= hash >> 32;
+	return (size_t)(hash % cache->set_count);
+	}
+
+static inline CifrasCacheEntry* set_find(CifrasCacheSet* set,
+	const CacheKey* key)
+	{
+	int i;
+
+	for (i = 0; i < CIFRAS_CACHE_WAYS; i++)
+		if (set->entries[i].numbers == key->numbers &&
+			set->entries[i].target == key->target &&
+			set->entries[i].numbers_count == key->numbers_count)
+			return &set->entries[i];
+	return NULL;
+	}
+
+int cifras_cache_init(CifrasCache* cache, size_t capacity)
+	{
+	int i;
+
+	assert(cache != NULL);
+
+	cache->set_count = (capacity + CIFRAS_CACHE_WAYS - 1) / CIFRAS_CACHE_WAYS;
+	if (cache->set_count == 0)
+		cache->set_count = 1;
+	// calloc: every entry empty (numbers 0)
+	cache->sets = calloc(cache->set_count, sizeof(CifrasCacheSet));
+	if (cache->sets == NULL)
+		return 1;
+	for (i = 0; i < CIFRAS_CACHE_STRIPES; i++)
+		{
+		pthread_mutex_init(&cache->stripes[i].mutex, NULL);
+		cache->stripes[i].stats = (CifrasCacheStats){0, 0, 0, 0};
+		}
+	return 0;
+	}
+
+void cifras_cache_free(CifrasCache* cache)
+	{
+	int i;
+
+	assert(cache != NULL);
+	for (i = 0; i < CIFRAS_CACHE_STRIPES; i++)
+		pthread_mutex_destroy(&cache->stripes[i].mutex);
+	free(cache->sets);
+	cache->sets = NULL;
+	}
+
+bool cifras_cache_lookup(CifrasCache* cache, const long int* numbers,
+	int numbers_count, int target, SolutionStepStack* best_steps)
+	{
+	long int sorted[MAX_NUM_COUNT];
+	uint8_t codes[MAX_SOLUTION_STEPS];
+	CifrasCacheEntry* entry;
+	CifrasCacheStripe* stripe;
+	CacheKey key;
+	size_t set;
+	int count = 0;
+
+	assert(cache != NULL);
+	assert(numbers != NULL);
+	assert(best_steps != NULL);
+
+	if (cache_key(&key, sorted, numbers, numbers_count, target) == false)
+		return false;
+	set = cache_set(cache, &key);
+	stripe = &cache->stripes[set % CIFRAS_CACHE_STRIPES];
+	pthread_mutex_lock(&stripe->mutex);
+	entry = set_find(&cache->sets[set], &key);
+	if (entry != NULL)
+		{
+		entry->referenced = 1;
+		count = entry->steps_count;
+		memcpy(codes, entry->codes, count);
+		stripe->stats.hits++;
+		}
+	else
+		stripe->stats.misses++;
+	pthread_mutex_unlock(&stripe->mutex);
+	if (entry == NULL)
+		return false;
+
+	// Steps over the sorted numbers, then replayed over the numbers of the
+	// caller
+	steps_stack_init(best_steps);
+	steps_stack_from_codes(best_steps, sorted, numbers_count, codes, count);
+	steps_codes(numbers, numbers_count, best_steps, codes);
+	steps_stack_init(best_steps);
+	steps_stack_from_codes(best_steps, numbers, numbers_count, codes, count);
+	return true;
+	}
+
+void cifras_cache_store(CifrasCache* cache, const long int* numbers,
+	int numbers_count, int target, const SolutionStepStack* best_steps)
+	{
+	long int sorted[MAX_NUM_COUNT];
+	uint8_t codes[MAX_SOLUTION_STEPS];
+	CifrasCacheEntry* entry;
+	CifrasCacheStripe* stripe;
+	CifrasCacheSet* set;
+	CacheKey key;
+	size_t set_index;
+
+	assert(cache != NULL);
+	assert(numbers != NULL);
+	assert(best_steps != NULL);
+
+	if (cache_key(&key, sorted, numbers, numbers_count, target) == false)
+		return;
+	steps_codes(sorted, numbers_count, best_steps, codes);
+	set_index = cache_set(cache, &key);
+	set = &cache->sets[set_index];
+	stripe = &cache->stripes[set_index % CIFRAS_CACHE_STRIPES];
+	pthread_mutex_lock(&stripe->mutex);
+	// Another thread may have stored it after our miss
+	entry = set_find(set, &key);
+	if (entry == NULL)
+		{
+		// CLOCK: the first entry not referenced since the last pass
+		while (set->entries[set->hand].referenced)
+			{
+			set->entries[set->hand].referenced = 0;
+			set->hand = (set->hand + 1) % CIFRAS_CACHE_WAYS;
+			}
+		entry = &set->entries[set->hand];
+		set->hand = (set->hand + 1) % CIFRAS_CACHE_WAYS;
+		if (entry->numbers != 0)
+			stripe->stats.evictions++;
+		stripe->stats.insertions++;
+		}
+	entry->numbers = key.numbers;
+	entry->target = key.target;
+	entry->numbers_count = key.numbers_count;
+	entry->referenced = 0;
+	entry->steps_count = (uint8_t)steps_stack_count(best_steps);
+	memcpy(entry->codes, codes, entry->steps_count);
+	pthread_mutex_unlock(&stripe->mutex);
+	}
+
+void resolve_cifras_cached(CifrasCache* cache, const long int* numbers,
+	int numbers_count, int target, SolutionStepStack* best_steps,
+	CifrasEngine engine)
+	{
+	if (cache != NULL && cifras_cache_lookup(cache, numbers, numbers_count,
+		target, best_steps))
+		return;
+	resolve_cifras_engine(numbers, numbers_count, target, best_steps, engine);
+	if (cache != NULL)
+		cifras_cache_store(cache, numbers, numbers_count, target, best_steps);
+	}
+
+void cifras_cache_stats(CifrasCache* cache, CifrasCacheStats* stats)
+	{
+	CifrasCacheStripe* stripe;
+	int i;
+
+	assert(cache != NULL);
+	assert(stats != NULL);
+
+	*stats = (CifrasCacheStats){0, 0, 0, 0};
+	for (i = 0; i < CIFRAS_CACHE_STRIPES; i++)
+		{
+		stripe = &cache->stripes[i];
+		pthread_mutex_lock(&stripe->mutex);
+		stats->hits += stripe->stats.hits;
+		stats->misses += stripe->stats.misses;
+		stats->insertions += stripe->stats.insertions;
+		stats->evictions += stripe->stats.evictions;
+		pthread_mutex_unlock(&stripe->mutex);
+		}
+	}
@@ -0,0 +1,100 @@
+#ifndef CIFRAS_CACHE_H
+#define CIFRAS_CACHE_H
+
+#include "cifras_bt.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed-size cache of solutions in front of the solvers, for workloads that
+// repeat games (the random games are drawn from 13 values only).
+//
+// The key is the multiset of numbers (sorted) plus the target, so the same
+// game with the numbers in any order is a hit, and the value is the best
+// steps coded with step_code over the sorted numbers (a few bytes per entry).
+// A hit replays the steps over the numbers in the order of the caller, so
+// the steps are written the same way a search of those numbers would write
+// them (for example 50*10 instead of 10*50 if 50 comes first).
+//
+// The table is set-associative: the hash of the key picks a set of
+// CIFRAS_CACHE_WAYS entries and, if the key is not there, the CLOCK
+// algorithm picks the entry to replace within the set (entries hit since the
+// hand passed them get a second chance). The sets are protected by
+// CIFRAS_CACHE_STRIPES mutexes (set i by mutex i % CIFRAS_CACHE_STRIPES), so
+// threads only contend when they touch sets of the same stripe, and a lock is
+// never held during a search.
+//
+// Only games whose numbers are between MIN_NUMBER and MAX_NUMBER are cached.
+
+#define CIFRAS_CACHE_WAYS 8
+#define CIFRAS_CACHE_STRIPES 64
+
+typedef struct
+	{
+	// Sorted numbers, one per byte. 0 if the entry is empty
+	uint64_t numbers;
+	int32_t target;
+	uint8_t numbers_count;
+	// CLOCK bit: set by every hit, cleared when the hand passes
+	uint8_t referenced;
+	uint8_t steps_count;
+	uint8_t codes[MAX_SOLUTION_STEPS];
+	} CifrasCacheEntry;
+
+typedef struct
+	{
+	CifrasCacheEntry entries[CIFRAS_CACHE_WAYS];
+	uint8_t hand;
+	} CifrasCacheSet;
+
+typedef struct
+	{
+	unsigned long long hits;
+	unsigned long long misses;
+	// Entries stored
+	unsigned long long insertions;
+	// Stored entries replaced by other ones
+	unsigned long long evictions;
+	} CifrasCacheStats;
+
+// Lock and counters of the sets of one stripe, in their own cache line
+typedef struct
+	{
+	_Alignas(64) pthread_mutex_t mutex;
+	CifrasCacheStats stats;
+	} CifrasCacheStripe;
+
+typedef struct
+	{
+	CifrasCacheSet* sets;
+	size_t set_count;
+	CifrasCacheStripe stripes[CIFRAS_CACHE_STRIPES];
+	} CifrasCache;
+
+// Cache of (about) capacity entries, rounded up to whole sets.
+// Return values:
+// 0: cache ready
+// 1: out of memory
+int cifras_cache_init(CifrasCache* cache, size_t capacity);
+void cifras_cache_free(CifrasCache* cache);
+
+// Fill best_steps with the cached solution of the game, if any.
+// Return false on a miss
+bool cifras_cache_lookup(CifrasCache* cache, const long int* numbers,
+	int numbers_count, int target, SolutionStepStack* best_steps);
+// Store the solution of a game (replacing the one cached, if any)
+void cifras_cache_store(CifrasCache* cache, const long int* numbers,
+	int numbers_count, int target, const SolutionStepStack* best_steps);
+
+// resolve_cifras_engine through the cache: a miss is solved and stored.
+// cache may be NULL
+void resolve_cifras_cached(CifrasCache* cache, const long int* numbers,
+	int numbers_count, int target, SolutionStepStack* best_steps,
+	CifrasEngine engine);
+
+// Counters summed over every stripe
+void cifras_cache_stats(CifrasCache* cache, CifrasCacheStats* stats);
+
+#endif
@@ -0,0 +1,177 @@
+#include "cifras_db.h"
+#include "cifras_ops.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t binomial(int n, int k)
+	{
+	uint64_t result = 1;
+	int i;
+
+	if (k < 0 || k > n)
+		return 0;
+	for (i = 1; i <= k; i++)
+		result = result * (uint64_t)(n - k + i) / (uint64_t)i;
+	return result;
+	}
+
+// A multiset of NUM_COUNT indexes v0 <= v1 <= ... is mapped to the set of
+// distinct numbers v0 < v1 + 1 < v2 + 2 < ... and ranked in the
+// combinatorial number system
+uint64_t cifras_db_multiset_count(int pool_count)
+	{
+	return binomial(pool_count + NUM_COUNT - 1, NUM_COUNT);
+	}
+
+uint64_t cifras_db_multiset_rank(const int* sorted_indexes, int pool_count)
+	{
+	uint64_t rank = 0;
+	int i;
+
+	assert(sorted_indexes != NULL);
+	for (i = 0; i < NUM_COUNT; i++)
+		{
+		assert(sorted_indexes[i] >= 0 && sorted_indexes[i] < pool_count);
+		assert(i == 0 || sorted_indexes[i - 1] <= sorted_indexes[i]);
+		rank += binomial(sorted_indexes[i] + i, i + 1);
+		}
+	(void)pool_count;
+	return rank;
+	}
+
+int cifras_db_open(CifrasDb* db, const char* path)
+	{
+	const CifrasDbHeader* header;
+	struct stat st;
+	void* map;
+	size_t expected_size;
+	int fd, i;
+
+	assert(db != NULL);
+	assert(path != NULL);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		{
+		perror("Error in cifras_db_open: open");
+		return 1;
+		}
+	if (fstat(fd, &st) != 0)
+		{
+		perror("Error in cifras_db_open: fstat");
+		close(fd);
+		return 1;
+		}
+	if ((size_t)st.st_size < sizeof(CifrasDbHeader))
+		{
+		fprintf(stderr, "Error in cifras_db_open: %s is too small\n", path);
+		close(fd);
+		return 1;
+		}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		{
+		perror("Error in cifras_db_open: mmap");
+		return 1;
+		}
+
+	header = map;
+	expected_size = sizeof(CifrasDbHeader) + header->multiset_count *
+		(header->max_target - header->min_target + 1) * sizeof(CifrasDbRecord);
+	if (memcmp(header->magic, CIFRAS_DB_MAGIC, sizeof(header->magic)) != 0 ||
+		header->version != CIFRAS_DB_VERSION ||
+		header->byte_order != 0x01020304 ||
+		header->num_count != NUM_COUNT ||
+		header->max_solution_steps != CIFRAS_DB_MAX_STEPS ||
+		header->record_size != sizeof(CifrasDbRecord) ||
+		header->pool_count == 0 || header->pool_count > CIFRAS_DB_MAX_POOL ||
+		header->min_target > header->max_target ||
+		header->multiset_count != cifras_db_multiset_count(header->pool_count) ||
+		(size_t)st.st_size != expected_size)
+		{
+		fprintf(stderr, "Error in cifras_db_open: %s has a wrong format ", path);
+		fprintf(stderr, "or was built with different constants\n");
+		munmap(map, st.st_size);
+		return 1;
+		}
+
+	memset(db->pool_index, -1, sizeof(db->pool_index));
+	for (i = 0; i < (int)header->pool_count; i++)
+		if (header->pool[i] >= MIN_NUMBER && header->pool[i] <= MAX_NUMBER)
+			db->pool_index[header->pool[i]] = (int8_t)i;
+
+	// Records will be read randomly
+	madvise(map, st.st_size, MADV_RANDOM);
+	db->header = header;
+	db->records = (const CifrasDbRecord*)(header + 1);
+	db->map_size = st.st_size;
+	return 0;
+	}
+
+void cifras_db_close(CifrasDb* db)
+	{
+	assert(db != NULL);
+	if (db->header != NULL)
+		munmap((void*)db->header, db->map_size);
+	db->header = NULL;
+	db->records = NULL;
+	}
+
+bool cifras_db_lookup(const CifrasDb* db, const long int* numbers, int target,
+	SolutionStepStack* best_steps)
+	{
+	const CifrasDbHeader* header;
+	const CifrasDbRecord* record;
+	long int sorted_numbers[NUM_COUNT];
+	int indexes[NUM_COUNT];
+	int i, j, index;
+	uint64_t rank;
+
+	assert(db != NULL);
+	assert(numbers != NULL);
+	assert(best_steps != NULL);
+
+	header = db->header;
+	if (target < header->min_target || target > header->max_target)
+		return false;
+
+	// Insertion sort of the pool indexes
+	for (i = 0; i < NUM_COUNT; i++)
+		{
+		if (numbers[i] < MIN_NUMBER || numbers[i] > MAX_NUMBER)
+			return false;
+		index = db->pool_index[numbers[i]];
+		if (index < 0)
+			return false;
+		for (j = i; j > 0 && indexes[j - 1] > index; j--)
+			indexes[j] = indexes[j - 1];
+		indexes[j] = index;
+		}
+	for (i = 0; i < NUM_COUNT; i++)
+		sorted_numbers[i] = header->pool[indexes[i]];
+
+	rank = cifras_db_multiset_rank(indexes, header->pool_count);
+	record = &db->records[rank * (header->max_target - header->min_target + 1) +
+		(target - header->min_target)];
+	steps_stack_init(best_steps);
+	steps_stack_from_codes(best_steps, sorted_numbers, NUM_COUNT, record->codes,
+		record->count);
+	assert(record->count == 0 || steps_stack_result(best_steps) == record->result);
+	return true;
+	}
+
+void resolve_cifras_db(const CifrasDb* db, const long int* numbers, int target,
+	SolutionStepStack* best_steps)
+	{
+	if (db != NULL && db->header != NULL &&
+		cifras_db_lookup(db, numbers, target, best_steps))
+		return;
+	resolve_cifras(numbers, target, best_steps);
+	}
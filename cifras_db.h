@@ -0,0 +1,85 @@
+#ifndef CIFRAS_DB_H
+#define CIFRAS_DB_H
+
+#include "cifras_bt.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Precomputed solutions of every game whose numbers belong to a small pool of
+// values (the ones drawn by cifras_random_numbers) and whose target is
+// between MIN_TARGET and MAX_TARGET.
+//
+// File layout (native byte order):
+// 1. CifrasDbHeader
+// 2. One CifrasDbRecord per (multiset of numbers, target), ordered by the
+// rank of the multiset and then by the target
+//
+// The rank of a multiset is computed over the indexes of its numbers in the
+// pool, sorted in ascending order (see multiset_rank in cifras_db.c). Every
+// record codes its steps with step_code (cifras_ops.h) over the numbers
+// sorted in ascending order, so a lookup returns the same steps whatever the
+// order of the numbers of the caller
+
+#define CIFRAS_DB_MAGIC "CIFRASDB"
+#define CIFRAS_DB_VERSION 3
+#define CIFRAS_DB_MAX_POOL 32
+// Only games of NUM_COUNT numbers are stored
+#define CIFRAS_DB_MAX_STEPS (NUM_COUNT - 1)
+
+typedef struct
+	{
+	char magic[8];
+	uint32_t version;
+	// Written as 0x01020304 to detect files with a different byte order
+	uint32_t byte_order;
+	uint32_t num_count;
+	uint32_t max_solution_steps;
+	uint32_t record_size;
+	uint32_t pool_count;
+	int32_t pool[CIFRAS_DB_MAX_POOL];
+	int32_t min_target;
+	int32_t max_target;
+	uint64_t multiset_count;
+	} CifrasDbHeader;
+
+typedef struct
+	{
+	int16_t result;
+	uint8_t count;
+	uint8_t codes[CIFRAS_DB_MAX_STEPS];
+	} CifrasDbRecord;
+
+typedef struct
+	{
+	const CifrasDbHeader* header;
+	const CifrasDbRecord* records;
+	size_t map_size;
+	// Index in the pool of every value or -1 if the value is not in the pool
+	int8_t pool_index[MAX_NUMBER + 1];
+	} CifrasDb;
+
+// Number of multisets of NUM_COUNT numbers with pool_count values
+uint64_t cifras_db_multiset_count(int pool_count);
+
+// Rank of the multiset whose pool indexes are sorted (ascending)
+uint64_t cifras_db_multiset_rank(const int* sorted_indexes, int pool_count);
+
+// Map the file at path.
+// Return values:
+// 0: db ready
+// 1: the file cannot be used (I/O error, wrong format or wrong constants)
+int cifras_db_open(CifrasDb* db, const char* path);
+void cifras_db_close(CifrasDb* db);
+
+// Fill best_steps with the precomputed solution without any allocation.
+// Return false if the game is not covered by the db
+bool cifras_db_lookup(const CifrasDb* db, const long int* numbers, int target,
+	SolutionStepStack* best_steps);
+
+// cifras_db_lookup with resolve_cifras as fallback. db may be NULL
+void resolve_cifras_db(const CifrasDb* db, const long int* numbers, int target,
+	SolutionStepStack* best_steps);
+
+#endif
@@ -0,0 +1,155 @@
+// Offline builder of the solutions db read by cifras_db.c.
+//
+// Usage: cifras_db_build OUTPUT [THREADS]
+//
+// Every multiset of the pool is solved for all the targets with a single
+// cifras_reachable_all walk. The multisets are spread among the threads of
+// the work pool
+
+#include "cifras_db.h"
+#include "cifras_reach.h"
+#include "work_pool.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Small numbers 1-9 and RANDOM_BIG_NUMBERS of main.c
+static const int32_t DB_POOL[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 25, 50, 100};
+static const int DB_POOL_COUNT = sizeof(DB_POOL) / sizeof(DB_POOL[0]);
+
+typedef struct
+	{
+	// Pool indexes of every multiset, NUM_COUNT per multiset
+	int* multisets;
+	CifrasDbRecord* records;
+	ReachTable* tables;
+	} DbBuildJob;
+
+static void build_multiset(void* arg, size_t task_index, int worker_id)
+	{
+	DbBuildJob* job = arg;
+	const int* indexes = &job->multisets[task_index * NUM_COUNT];
+	ReachTable* table = &job->tables[worker_id];
+	CifrasDbRecord* records;
+	const ReachEntry* entry;
+	long int numbers[NUM_COUNT];
+	uint64_t rank;
+	int i, value;
+
+	for (i = 0; i < NUM_COUNT; i++)
+		numbers[i] = DB_POOL[indexes[i]];
+	cifras_reachable_all(numbers, table);
+
+	rank = cifras_db_multiset_rank(indexes, DB_POOL_COUNT);
+	records = &job->records[rank * REACH_TARGET_COUNT];
+	for (i = 0; i < REACH_TARGET_COUNT; i++)
+		{
+		value = table->best[i];
+		entry = &table->values[value];
+		records[i].result = (int16_t)value;
+		records[i].count = entry->count;
+		memcpy(records[i].codes, entry->codes, sizeof(records[i].codes));
+		}
+	}
+
+// Fill multisets with all the sorted tuples of NUM_COUNT pool indexes.
+// Return the number of tuples
+static size_t enumerate_multisets(int* multisets)
+	{
+	int indexes[NUM_COUNT] = {0};
+	size_t count = 0;
+	int i;
+
+	for (;;)
+		{
+		memcpy(&multisets[count++ * NUM_COUNT], indexes, sizeof(indexes));
+
+		// Next tuple in lexicographic order keeping indexes sorted
+		for (i = NUM_COUNT - 1; i >= 0 && indexes[i] == DB_POOL_COUNT - 1; i--)
+			;
+		if (i < 0)
+			return count;
+		indexes[i]++;
+		for (i++; i < NUM_COUNT; i++)
+			indexes[i] = indexes[i - 1];
+		}
+	}
+
+int main(int argc, char** argv)
+	{
+	CifrasDbHeader header;
+	DbBuildJob job;
+	FILE* output;
+	uint64_t multiset_count;
+	size_t record_count;
+	int nthreads = 0;
+	int i, ret = 0;
+
+	if (argc < 2 || argc > 3)
+		{
+		fprintf(stderr, "Usage: %s OUTPUT [THREADS]\n", argv[0]);
+		return 1;
+		}
+	if (argc == 3)
+		nthreads = atoi(argv[2]);
+	if (nthreads <= 0)
+		nthreads = work_pool_default_threads();
+
+	multiset_count = cifras_db_multiset_count(DB_POOL_COUNT);
+	record_count = multiset_count * REACH_TARGET_COUNT;
+	job.multisets = malloc(sizeof(int) * NUM_COUNT * multiset_count);
+	job.records = calloc(record_count, sizeof(CifrasDbRecord));
+	job.tables = malloc(sizeof(ReachTable) * nthreads);
+	if (job.multisets == NULL || job.records == NULL || job.tables == NULL)
+		{
+		fprintf(stderr, "Error in main: out of memory\n");
+		return 1;
+		}
+	i = (int)enumerate_multisets(job.multisets);
+	assert((uint64_t)i == multiset_count);
+
+	fprintf(stderr, "Solving %llu multisets with %d threads...\n",
+		(unsigned long long)multiset_count, nthreads);
+	if (work_pool_run(multiset_count, nthreads, build_multiset, &job) != 0)
+		return 1;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CIFRAS_DB_MAGIC, sizeof(header.magic));
+	header.version = CIFRAS_DB_VERSION;
+	header.byte_order = 0x01020304;
+	header.num_count = NUM_COUNT;
+	header.max_solution_steps = CIFRAS_DB_MAX_STEPS;
+	header.record_size = sizeof(CifrasDbRecord);
+	header.pool_count = DB_POOL_COUNT;
+	for (i = 0; i < DB_POOL_COUNT; i++)
+		header.pool[i] = DB_POOL[i];
+	header.min_target = MIN_TARGET;
+	header.max_target = MAX_TARGET;
+	header.multiset_count = multiset_count;
+
+	output = fopen(argv[1], "wb");
+	if (output == NULL)
+		{
+		perror("Error in main: fopen");
+		return 1;
+		}
+	if (fwrite(&header, sizeof(header), 1, output) != 1 ||
+		fwrite(job.records, sizeof(CifrasDbRecord), record_count, output) !=
+		record_count)
+		{
+		perror("Error in main: fwrite");
+		ret = 1;
+		}
+	if (fclose(output) != 0)
+		{
+		perror("Error in main: fclose");
+		ret = 1;
+		}
+
+	free(job.multisets);
+	free(job.records);
+	free(job.tables);
+	return ret;
+	}
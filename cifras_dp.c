@@ -0,0 +1,400 @@
+#include "cifras_dp.h"
+#include "cifras_ops.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DP_SUBSETS (1 << MAX_NUM_COUNT)
+// Initial sizes, doubled when needed
+#define DP_INITIAL_VALUES 4096
+#define DP_INITIAL_SLOTS_BITS 10
+
+// How a value of the subset S was obtained: operation op_index between
+// values[left_index] (subset left) and values[right_index] (subset S ^ left)
+typedef struct
+	{
+	uint32_t left_index;
+	uint32_t right_index;
+	uint8_t left;
+	uint8_t op_index;
+	} DpOrigin;
+
+typedef struct
+	{
+	// Values of every stored subset, one range [begin, begin + count) per
+	// subset, and their origins (parallel array)
+	long int* values;
+	DpOrigin* origins;
+	size_t size;
+	size_t capacity;
+	size_t begin[DP_SUBSETS];
+	size_t count[DP_SUBSETS];
+	// Hash set of the values of the subset being built: index + 1 in values
+	// or 0 if the slot is free
+	uint32_t* slots;
+	int slots_bits;
+	// The values may overflow (numbers_are_narrow is false): the steps are
+	// built by build_candidate_wide
+	bool wide;
+	} DpTable;
+
+typedef struct
+	{
+	int target;
+	// Distance to the target of the best value or -1 if there is none yet
+	long int diff;
+	int subset;
+	DpOrigin origin;
+	} DpBest;
+
+// Values below DP_FIRST_VALUES. The best value of a game of classic numbers
+// for any target between MIN_TARGET and MAX_TARGET is always below it: the
+// sum of two numbers (at most 2 * MAX_NUMBER) is always a candidate
+#define DP_FIRST_VALUES (2 * MAX_TARGET)
+#if 2 * MAX_NUMBER >= DP_FIRST_VALUES
+	#error "DP_FIRST_VALUES does not cover the results of every target"
+#endif
+
+// First candidate of every value, in the order the candidates are compared
+// with the target. It answers any target the same way as DpBest: the best
+// value is the first candidate at the minimal distance
+typedef struct
+	{
+	// Order of the first candidate of every value, 0 if never seen
+	uint32_t order[DP_FIRST_VALUES];
+	int subset[DP_FIRST_VALUES];
+	DpOrigin origin[DP_FIRST_VALUES];
+	uint32_t count;
+	} DpFirst;
+
+static inline size_t dp_slot(long int value, int bits)
+	{
+	return (size_t)(((uint64_t)value * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+	}
+
+static bool dp_table_init(DpTable* table)
+	{
+	table->capacity = DP_INITIAL_VALUES;
+	table->size = 0;
+	table->values = malloc(sizeof(long int) * table->capacity);
+	table->origins = malloc(sizeof(DpOrigin) * table->capacity);
+	table->slots_bits = DP_INITIAL_SLOTS_BITS;
+	table->slots = malloc(sizeof(uint32_t) << table->slots_bits);
+	return table->values != NULL && table->origins != NULL &&
+		table->slots != NULL;
+	}
+
+static void dp_table_free(DpTable* table)
+	{
+	free(table->values);
+	free(table->origins);
+	free(table->slots);
+	}
+
+// Reinsert the values of the subset being built (from first onwards) in a
+// hash set of 2^bits slots
+static bool dp_table_rehash(DpTable* table, size_t first, int bits)
+	{
+	uint32_t* slots;
+	size_t i, slot, mask;
+
+	if (bits != table->slots_bits)
+		{
+		slots = realloc(table->slots, sizeof(uint32_t) << bits);
+		if (slots == NULL)
+			return false;
+		table->slots = slots;
+		table->slots_bits = bits;
+		}
+	memset(table->slots, 0, sizeof(uint32_t) << bits);
+	mask = ((size_t)1 << bits) - 1;
+	for (i = first; i < table->size; i++)
+		{
+		for (slot = dp_slot(table->values[i], bits);
+			table->slots[slot] != 0; slot = (slot + 1) & mask)
+			;
+		table->slots[slot] = (uint32_t)(i + 1);
+		}
+	return true;
+	}
+
+// Add value to the subset being built (values from first onwards) unless it
+// is already there. Return false if out of memory
+static bool dp_table_add(DpTable* table, size_t first, long int value,
+	const DpOrigin* origin)
+	{
+	size_t slot, mask, capacity;
+	long int* values;
+	DpOrigin* origins;
+	uint32_t index;
+
+	mask = ((size_t)1 << table->slots_bits) - 1;
+	for (slot = dp_slot(value, table->slots_bits);
+		(index = table->slots[slot]) != 0; slot = (slot + 1) & mask)
+		if (table->values[index - 1] == value)
+			return true;
+
+	if (table->size == table->capacity)
+		{
+		capacity = table->capacity * 2;
+		if (capacity > UINT32_MAX)
+			return false;
+		values = realloc(table->values, sizeof(long int) * capacity);
+		if (values == NULL)
+			return false;
+		table->values = values;
+		origins = realloc(table->origins, sizeof(DpOrigin) * capacity);
+		if (origins == NULL)
+			return false;
+		table->origins = origins;
+		table->capacity = capacity;
+		}
+	table->values[table->size] = value;
+	table->origins[table->size] = *origin;
+	table->size++;
+	table->slots[slot] = (uint32_t)table->size;
+
+	// Load factor up to 1/2
+	if ((table->size - first) * 2 > mask + 1)
+		return dp_table_rehash(table, first, table->slots_bits + 1);
+	return true;
+	}
+
+// Combine every pair of disjoint subsets whose union is subset. The values
+// are compared with best (or recorded in first, if not NULL) and, if store is
+// true, added to the table.
+// Return false if out of memory
+static bool dp_build_subset(DpTable* table, int subset, bool store,
+	DpBest* best, DpFirst* first_seen)
+	{
+	SolutionStep step;
+	DpOrigin origin;
+	const long int* left_values;
+	const long int* right_values;
+	size_t first = table->size;
+	size_t l, r, left_count, right_count;
+	long int diff;
+	int left, right, low, op;
+
+	if (store && dp_table_rehash(table, first, table->slots_bits) == false)
+		return false;
+
+	// The left subset always contains the lowest number of subset, so every
+	// unordered pair of subsets is combined once
+	low = subset & -subset;
+	for (left = (subset - 1) & subset; left > 0; left = (left - 1) & subset)
+		{
+		if ((left & low) == 0)
+			continue;
+		right = subset ^ left;
+		left_values = &table->values[table->begin[left]];
+		right_values = &table->values[table->begin[right]];
+		left_count = table->count[left];
+		right_count = table->count[right];
+		origin.left = (uint8_t)left;
+		for (l = 0; l < left_count; l++)
+			for (r = 0; r < right_count; r++)
+				for (op = 0; op < 4; op++)
+					{
+					if ((table->wide ? build_candidate_wide(&step,
+						left_values[l], right_values[r], op) :
+						build_candidate(&step, left_values[l], right_values[r],
+						op)) == false)
+						continue;
+					origin.left_index = (uint32_t)(table->begin[left] + l);
+					origin.right_index = (uint32_t)(table->begin[right] + r);
+					origin.op_index = (uint8_t)op;
+
+					if (first_seen != NULL)
+						{
+						if (step.result >= 0 && step.result < DP_FIRST_VALUES &&
+							first_seen->order[step.result] == 0)
+							{
+							first_seen->order[step.result] = ++first_seen->count;
+							first_seen->subset[step.result] = subset;
+							first_seen->origin[step.result] = origin;
+							}
+						}
+					else
+						{
+						// Subsets are built by increasing size, so a value is
+						// only better than best if it is nearer the target
+						diff = labs(step.result - (long int)best->target);
+						if (best->diff < 0 || diff < best->diff)
+							{
+							best->diff = diff;
+							best->subset = subset;
+							best->origin = origin;
+							// Nothing can beat an exact result with fewer
+							// steps
+							if (diff == 0)
+								return true;
+							}
+						}
+					if (store && dp_table_add(table, first, step.result,
+						&origin) == false)
+						return false;
+					// The table may have been reallocated
+					left_values = &table->values[table->begin[left]];
+					right_values = &table->values[table->begin[right]];
+					}
+		}
+	table->begin[subset] = first;
+	table->count[subset] = table->size - first;
+	return true;
+	}
+
+// Append the steps of the value of subset built as origin
+static void dp_push_steps(const DpTable* table, int subset,
+	const DpOrigin* origin, SolutionStepStack* best_steps)
+	{
+	SolutionStep step;
+	int right = subset ^ origin->left;
+
+	// Single numbers have no steps
+	if ((origin->left & (origin->left - 1)) != 0)
+		dp_push_steps(table, origin->left, &table->origins[origin->left_index],
+			best_steps);
+	if ((right & (right - 1)) != 0)
+		dp_push_steps(table, right, &table->origins[origin->right_index],
+			best_steps);
+	step_apply(&step, table->values[origin->left_index],
+		table->values[origin->right_index], origin->op_index);
+	steps_stack_push(best_steps, &step);
+	}
+
+static int popcount(int subset)
+	{
+	int count = 0;
+
+	for (; subset != 0; subset &= subset - 1)
+		count++;
+	return count;
+	}
+
+// Build the values of every subset of numbers, comparing them with best (or
+// recording them in first_seen, if not NULL).
+// Return false if out of memory
+static bool cifras_dp(DpTable* table, const long int* numbers,
+	int numbers_count, DpBest* best, DpFirst* first_seen)
+	{
+	int full = (1 << numbers_count) - 1;
+	int size, subset, i;
+
+	table->wide = numbers_are_narrow(numbers, numbers_count) == false;
+	for (i = 0; i < numbers_count; i++)
+		{
+		table->values[i] = numbers[i];
+		table->begin[1 << i] = i;
+		table->count[1 << i] = 1;
+		}
+	table->size = numbers_count;
+
+	for (size = 2; size <= numbers_count; size++)
+		for (subset = 1; subset <= full; subset++)
+			{
+			if (popcount(subset) != size)
+				continue;
+			// The values of the whole set are never combined again
+			if (dp_build_subset(table, subset, size < numbers_count,
+				best, first_seen) == false)
+				return false;
+			if (best != NULL && best->diff == 0)
+				return true;
+			}
+	return true;
+	}
+
+void resolve_cifras_dp(const long int* numbers, int numbers_count, int target,
+	SolutionStepStack* best_steps)
+	{
+	DpTable table;
+	DpBest best;
+
+	assert(numbers != NULL);
+	assert(numbers_count >= MIN_NUM_COUNT && numbers_count <= MAX_NUM_COUNT);
+	assert(target >= 0);
+	assert(best_steps != NULL);
+
+	best = (DpBest){target, -1, 0, {0, 0, 0, 0}};
+	if (dp_table_init(&table) == false ||
+		cifras_dp(&table, numbers, numbers_count, &best, NULL) == false)
+		{
+		dp_table_free(&table);
+		resolve_cifras_n(numbers, numbers_count, target, best_steps);
+		return;
+		}
+
+	steps_stack_init(best_steps);
+	if (best.diff >= 0)
+		dp_push_steps(&table, best.subset, &best.origin, best_steps);
+	dp_table_free(&table);
+	}
+
+// Best value of first_seen for target: the nearest one and, at the same
+// distance, the first one compared. -1 if there is none
+static int dp_first_best(const DpFirst* first_seen, int target)
+	{
+	int diff, below, above;
+
+	for (diff = 0; target + diff < DP_FIRST_VALUES; diff++)
+		{
+		below = target - diff >= 0 && first_seen->order[target - diff] != 0 ?
+			target - diff : -1;
+		above = first_seen->order[target + diff] != 0 ? target + diff : -1;
+		if (below >= 0 && (above < 0 ||
+			first_seen->order[below] < first_seen->order[above]))
+			return below;
+		if (above >= 0)
+			return above;
+		}
+	return -1;
+	}
+
+int resolve_cifras_dp_targets(const long int* numbers, int numbers_count,
+	const int* targets, size_t targets_count, SolutionStepStack* best_steps)
+	{
+	DpTable table;
+	DpFirst* first_seen;
+	size_t k;
+	int value, i;
+
+	assert(numbers != NULL);
+	assert(numbers_count >= MIN_NUM_COUNT && numbers_count <= MAX_NUM_COUNT);
+	assert(targets != NULL || targets_count == 0);
+	assert(best_steps != NULL || targets_count == 0);
+
+	for (i = 0; i < numbers_count; i++)
+		if (numbers[i] < MIN_NUMBER || numbers[i] > MAX_NUMBER)
+			return 1;
+	for (k = 0; k < targets_count; k++)
+		if (targets[k] < MIN_TARGET || targets[k] > MAX_TARGET)
+			return 1;
+
+	first_seen = calloc(1, sizeof(DpFirst));
+	if (first_seen == NULL)
+		return 1;
+	if (dp_table_init(&table) == false ||
+		cifras_dp(&table, numbers, numbers_count, NULL, first_seen) == false)
+		{
+		dp_table_free(&table);
+		free(first_seen);
+		return 1;
+		}
+
+	for (k = 0; k < targets_count; k++)
+		{
+		steps_stack_init(&best_steps[k]);
+		value = dp_first_best(first_seen, targets[k]);
+		// See DP_FIRST_VALUES
+		assert(value >= 0);
+		dp_push_steps(&table, first_seen->subset[value],
+			&first_seen->origin[value], &best_steps[k]);
+		}
+	dp_table_free(&table);
+	free(first_seen);
+	return 0;
+	}
@@ -0,0 +1,41 @@
+#ifndef CIFRAS_DP_H
+#define CIFRAS_DP_H
+
+#include "cifras_bt.h"
+
+// Bottom-up dynamic programming over the subsets of the numbers.
+//
+// Every value reachable by combining exactly the numbers of a subset S takes
+// |S| - 1 steps, whatever the order of the steps. So the values of S are
+// built once by combining the values of every pair of disjoint subsets A, B
+// with A | B == S, smallest subsets first, instead of once per sequence of
+// steps as cifras_bt does. Every value keeps a back-pointer (the two values
+// and the operation) to rebuild its steps.
+//
+// The values of every subset are deduplicated with a hash set and stored in
+// a plain array, so the innermost loop walks two arrays of long int. The
+// values of the whole set are only compared with the target, never stored.
+//
+// Same rules for the operations as cifras_bt (build_candidate), so the best
+// result has the same distance to the target and the same steps count as the
+// one of resolve_cifras. Unlike cifras_bt, the cost does not depend on how
+// near the target the numbers can get, which makes it much faster on
+// unreachable targets.
+//
+// numbers_count: MIN_NUM_COUNT to MAX_NUM_COUNT.
+// Falls back to resolve_cifras_n if out of memory
+void resolve_cifras_dp(const long int* numbers, int numbers_count, int target,
+	SolutionStepStack* best_steps);
+
+// resolve_cifras_dp of the same numbers for every target of targets, into
+// best_steps[0..targets_count-1], with a single build of the values: the
+// first candidate of every value is recorded and every target picks among
+// them the same value and steps resolve_cifras_dp would. Only for classic
+// numbers (MIN_NUMBER to MAX_NUMBER) and targets (MIN_TARGET to MAX_TARGET).
+// Return values:
+// 0: every target solved
+// 1: numbers or targets out of range, or out of memory (nothing solved)
+int resolve_cifras_dp_targets(const long int* numbers, int numbers_count,
+	const int* targets, size_t targets_count, SolutionStepStack* best_steps);
+
+#endif
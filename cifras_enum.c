@@ -0,0 +1,463 @@
+#include "cifras_enum.h"
+#include "cifras_ops.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Initial size of the set of fingerprints, doubled when needed
+#define ENUM_INITIAL_SLOTS_BITS 10
+
+// Kinds of expressions of the normal form
+enum
+	{
+	ENUM_NUMBER,
+	// Chain of + and -
+	ENUM_SUM,
+	// Chain of * and /
+	ENUM_PRODUCT
+	};
+
+// Normal form of the expression of a pending number. A sum keeps the sums of
+// the fingerprints of its added (positive) and subtracted (negative) terms, so
+// combining two sums only adds them up. The same for the factors of products
+typedef struct
+	{
+	uint64_t fingerprint;
+	uint64_t positive;
+	uint64_t negative;
+	int kind;
+	// Steps of the path (bit k: step k) that build the number
+	uint8_t steps;
+	} EnumTerm;
+
+#if MAX_SOLUTION_STEPS > 8
+	#error "EnumTerm.steps needs a bit per step"
+#endif
+
+// Open addressing set of fingerprints (0: free slot)
+typedef struct
+	{
+	uint64_t* slots;
+	size_t count;
+	int bits;
+	} EnumSet;
+
+typedef struct
+	{
+	int target;
+	// resolve_cifras_all: every solution that reaches a target from
+	// min_target to max_target goes to callback
+	int min_target;
+	int max_target;
+	CifrasSolutionFn callback;
+	void* arg;
+	long int found;
+	bool stopped;
+	bool out_of_memory;
+	EnumSet seen;
+	// resolve_cifras_top: the best k solutions (unsorted) and their keys
+	// (distance << 8 | steps, as in cifras_bt) and fingerprints
+	SolutionStepStack* top;
+	unsigned long long* top_keys;
+	uint64_t* top_fingerprints;
+	int top_count;
+	int top_worst;
+	int k;
+	// Search state, updated in place as in cifras_bt
+	long int root_numbers[MAX_NUM_COUNT];
+	int root_count;
+	long int numbers[MAX_NUM_COUNT];
+	EnumTerm terms[MAX_NUM_COUNT];
+	uint8_t codes[MAX_SOLUTION_STEPS];
+	int depth;
+	// The values may overflow (numbers_are_narrow is false): the steps are
+	// built by build_candidate_wide
+	bool wide;
+	} EnumContext;
+
+// splitmix64 finalizer
+static inline uint64_t enum_mix(uint64_t x)
+	{
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBULL;
+	x ^= x >> 31;
+	return x;
+	}
+
+static void enum_term_number(EnumTerm* term, long int number)
+	{
+	term->fingerprint = enum_mix((uint64_t)number * 4 + ENUM_NUMBER) | 1;
+	term->positive = term->fingerprint;
+	term->negative = 0;
+	term->kind = ENUM_NUMBER;
+	term->steps = 0;
+	}
+
+// Normal form of step (step_index of the path) between the numbers of terms a
+// and b, in the order of step (a - b, a / b)
+static void enum_term_combine(EnumTerm* term, const EnumTerm* a,
+	const EnumTerm* b, char op, int step_index)
+	{
+	int kind = op == '+' || op == '-' ? ENUM_SUM : ENUM_PRODUCT;
+	uint64_t a_positive, a_negative, b_positive, b_negative;
+
+	// An operand of another kind is a single term of the chain
+	a_positive = a->kind == kind ? a->positive : a->fingerprint;
+	a_negative = a->kind == kind ? a->negative : 0;
+	b_positive = b->kind == kind ? b->positive : b->fingerprint;
+	b_negative = b->kind == kind ? b->negative : 0;
+
+	if (op == '+' || op == '*')
+		{
+		term->positive = a_positive + b_positive;
+		term->negative = a_negative + b_negative;
+		}
+	else
+		{
+		term->positive = a_positive + b_negative;
+		term->negative = a_negative + b_positive;
+		}
+	term->kind = kind;
+	term->fingerprint = enum_mix(enum_mix(term->positive + (uint64_t)kind) ^
+		term->negative) | 1;
+	term->steps = (uint8_t)(a->steps | b->steps | (1u << step_index));
+	}
+
+static bool enum_set_init(EnumSet* set)
+	{
+	set->bits = ENUM_INITIAL_SLOTS_BITS;
+	set->count = 0;
+	set->slots = calloc((size_t)1 << set->bits, sizeof(uint64_t));
+	return set->slots != NULL;
+	}
+
+// Add fingerprint. Return 1 if added, 0 if already there, -1 if out of memory
+static int enum_set_add(EnumSet* set, uint64_t fingerprint)
+	{
+	uint64_t* slots;
+	size_t mask, slot, i;
+	int bits;
+
+	mask = ((size_t)1 << set->bits) - 1;
+	for (slot = fingerprint >> (64 - set->bits); set->slots[slot] != 0;
+		slot = (slot + 1) & mask)
+		if (set->slots[slot] == fingerprint)
+			return 0;
+	set->slots[slot] = fingerprint;
+	set->count++;
+
+	// Load factor up to 1/2
+	if (set->count * 2 <= mask + 1)
+		return 1;
+	bits = set->bits + 1;
+	slots = calloc((size_t)1 << bits, sizeof(uint64_t));
+	if (slots == NULL)
+		return -1;
+	for (i = 0; i <= mask; i++)
+		{
+		if (set->slots[i] == 0)
+			continue;
+		for (slot = set->slots[i] >> (64 - bits); slots[slot] != 0;
+			slot = (slot + 1) & (((size_t)1 << bits) - 1))
+			;
+		slots[slot] = set->slots[i];
+		}
+	free(set->slots);
+	set->slots = slots;
+	set->bits = bits;
+	return 1;
+	}
+
+// Steps of the path ctx->codes[0..depth - 1] that build the number of term
+static void enum_solution_steps(const EnumContext* ctx, const EnumTerm* term,
+	SolutionStepStack* steps)
+	{
+	SolutionStepStack path;
+	int k;
+
+	steps_stack_init(&path);
+	steps_stack_from_codes(&path, ctx->root_numbers, ctx->root_count,
+		ctx->codes, ctx->depth);
+	steps_stack_init(steps);
+	for (k = 0; k < path.count; k++)
+		if (term->steps & (1u << k))
+			steps_stack_push(steps, &path.steps[k]);
+	}
+
+static int enum_popcount(unsigned bits)
+	{
+	int count = 0;
+
+	for (; bits != 0; bits &= bits - 1)
+		count++;
+	return count;
+	}
+
+// Largest distance to the target that can still be a solution
+static long int enum_max_diff(const EnumContext* ctx)
+	{
+	if (ctx->callback != NULL)
+		return 0;
+	if (ctx->top_count < ctx->k)
+		return -1;
+	return (long int)(ctx->top_keys[ctx->top_worst] >> 8);
+	}
+
+// The number of term (the result of the last step of the path) is a candidate
+// solution
+static void enum_offer(EnumContext* ctx, long int result, const EnumTerm* term)
+	{
+	SolutionStepStack steps;
+	unsigned long long key, diff;
+	int i, slot;
+
+	if (ctx->callback != NULL)
+		{
+		if (result < (long int)ctx->min_target ||
+			result > (long int)ctx->max_target)
+			return;
+		switch (enum_set_add(&ctx->seen, term->fingerprint))
+			{
+			case -1:
+				ctx->out_of_memory = ctx->stopped = true;
+				return;
+			case 0:
+				return;
+			}
+		ctx->found++;
+		enum_solution_steps(ctx, term, &steps);
+		if (ctx->callback(&steps, ctx->arg) == false)
+			ctx->stopped = true;
+		return;
+		}
+
+	// Distances clamped to 56 bits in wide games, as in cifras_bt
+	diff = (unsigned long long)labs(result - (long int)ctx->target);
+	if (diff >= 1ULL << 56)
+		diff = (1ULL << 56) - 1;
+	key = (diff << 8) | (unsigned long long)enum_popcount(term->steps);
+	// Replace the worst solution once there are k
+	slot = ctx->top_count < ctx->k ? ctx->top_count : ctx->top_worst;
+	if (slot < ctx->top_count && key >= ctx->top_keys[slot])
+		return;
+	for (i = 0; i < ctx->top_count; i++)
+		if (ctx->top_fingerprints[i] == term->fingerprint)
+			return;
+	if (slot == ctx->top_count)
+		ctx->top_count++;
+	ctx->top_keys[slot] = key;
+	ctx->top_fingerprints[slot] = term->fingerprint;
+	enum_solution_steps(ctx, term, &ctx->top[slot]);
+
+	ctx->top_worst = 0;
+	for (i = 1; i < ctx->top_count; i++)
+		if (ctx->top_keys[i] > ctx->top_keys[ctx->top_worst])
+			ctx->top_worst = i;
+	}
+
+// Same prune as prunable_upper_value: no value of the pending numbers can be
+// within max_diff of the target (of min_target for resolve_cifras_all)
+static bool enum_prunable(const long int* numbers, int numbers_count,
+	int target, long int max_diff)
+	{
+	long int upper_value = 1;
+	int i;
+
+	if (max_diff < 0)
+		return false;
+	for (i = 0; i < numbers_count && upper_value < (long int)target; i++)
+		if (__builtin_mul_overflow(upper_value, numbers[i] == 1 ? 2 : numbers[i],
+			&upper_value))
+			return false;
+	return (long int)target - upper_value > max_diff;
+	}
+
+// Symmetry prune of repeated_operand, for equal numbers with equal
+// expressions only
+static inline bool enum_repeated(const EnumContext* ctx, int from, int pos)
+	{
+	int k;
+
+	for (k = from; k < pos; k++)
+		if (ctx->numbers[k] == ctx->numbers[pos] &&
+			ctx->terms[k].fingerprint == ctx->terms[pos].fingerprint)
+			return true;
+	return false;
+	}
+
+// Every path of steps from the node of numbers_count pending numbers.
+// last_pos, last_step: as in cifras_bt
+static void cifras_enum(EnumContext* ctx, int numbers_count, int last_pos,
+	const SolutionStep* last_step)
+	{
+	long int* numbers = ctx->numbers;
+	EnumTerm* terms = ctx->terms;
+	SolutionStep candidate;
+	EnumTerm term1, term2, term;
+	long int operand1, operand2;
+	int i, j, op;
+
+	if (enum_prunable(numbers, numbers_count, ctx->callback != NULL ?
+		ctx->min_target : ctx->target, enum_max_diff(ctx)))
+		return;
+
+	for (i = 0; i < numbers_count && ctx->stopped == false; i++)
+		{
+		if (enum_repeated(ctx, 0, i))
+			continue;
+		for (j = i + 1; j < numbers_count && ctx->stopped == false; j++)
+			{
+			if (enum_repeated(ctx, i + 1, j))
+				continue;
+			operand1 = numbers[i];
+			operand2 = numbers[j];
+			term1 = terms[i];
+			term2 = terms[j];
+			for (op = 0; op < 4 && ctx->stopped == false; op++)
+				{
+				if ((ctx->wide ? build_candidate_wide(&candidate, operand1,
+					operand2, op) : build_candidate(&candidate, operand1,
+					operand2, op)) == false)
+					continue;
+				// Independent steps in the other order give the same
+				// expressions (steps_out_of_order)
+				if (last_step != NULL && i != last_pos && j != last_pos &&
+					steps_out_of_order(last_step, &candidate))
+					continue;
+
+				// build_candidate puts the larger operand first in - and /.
+				// x / x is the same step whichever x goes first, so the
+				// operand with the larger fingerprint does
+				if (operand1 == operand2 ?
+					term1.fingerprint > term2.fingerprint :
+					candidate.a == operand1)
+					enum_term_combine(&term, &term1, &term2, candidate.op,
+						ctx->depth);
+				else
+					enum_term_combine(&term, &term2, &term1, candidate.op,
+						ctx->depth);
+				ctx->codes[ctx->depth++] = step_code(i, j, op);
+				enum_offer(ctx, candidate.result, &term);
+
+				if (numbers_count > 2)
+					{
+					numbers_replace_pair(numbers, numbers_count, i, j,
+						candidate.result);
+					terms[i] = term;
+					terms[j] = terms[numbers_count - 1];
+					cifras_enum(ctx, numbers_count - 1, i, &candidate);
+					numbers_restore_pair(numbers, i, j, operand1, operand2);
+					terms[i] = term1;
+					terms[j] = term2;
+					}
+				ctx->depth--;
+				}
+			}
+		}
+	}
+
+static void enum_context_init(EnumContext* ctx, const long int* numbers,
+	int numbers_count, int target)
+	{
+	int i;
+
+	memset(ctx, 0, sizeof(EnumContext));
+	ctx->target = target;
+	for (i = 0; i < numbers_count; i++)
+		{
+		ctx->root_numbers[i] = numbers[i];
+		ctx->numbers[i] = numbers[i];
+		enum_term_number(&ctx->terms[i], numbers[i]);
+		}
+	ctx->root_count = numbers_count;
+	ctx->wide = numbers_are_narrow(numbers, numbers_count) == false;
+	}
+
+long int resolve_cifras_all(const long int* numbers, int numbers_count,
+	int target, CifrasSolutionFn callback, void* arg)
+	{
+	return resolve_cifras_all_targets(numbers, numbers_count, target, target,
+		callback, arg);
+	}
+
+long int resolve_cifras_all_targets(const long int* numbers, int numbers_count,
+	int min_target, int max_target, CifrasSolutionFn callback, void* arg)
+	{
+	EnumContext ctx;
+
+	assert(numbers != NULL);
+	assert(numbers_count >= MIN_NUM_COUNT && numbers_count <= MAX_NUM_COUNT);
+	assert(min_target >= 0 && min_target <= max_target);
+	assert(callback != NULL);
+
+	enum_context_init(&ctx, numbers, numbers_count, min_target);
+	ctx.min_target = min_target;
+	ctx.max_target = max_target;
+	ctx.callback = callback;
+	ctx.arg = arg;
+	if (enum_set_init(&ctx.seen) == false)
+		return -1;
+
+	cifras_enum(&ctx, numbers_count, -1, NULL);
+	free(ctx.seen.slots);
+	return ctx.out_of_memory ? -1 : ctx.found;
+	}
+
+int resolve_cifras_top(const long int* numbers, int numbers_count, int target,
+	int k, SolutionStepStack* solutions)
+	{
+	EnumContext ctx;
+	SolutionStepStack steps;
+	unsigned long long key;
+	uint64_t fingerprint;
+	int i, j;
+
+	assert(numbers != NULL);
+	assert(numbers_count >= MIN_NUM_COUNT && numbers_count <= MAX_NUM_COUNT);
+	assert(target >= 0);
+	assert(k >= 0);
+	assert(solutions != NULL || k == 0);
+
+	if (k == 0)
+		return 0;
+	enum_context_init(&ctx, numbers, numbers_count, target);
+	ctx.k = k;
+	ctx.top = solutions;
+	ctx.top_keys = malloc(sizeof(unsigned long long) * (size_t)k);
+	ctx.top_fingerprints = malloc(sizeof(uint64_t) * (size_t)k);
+	if (ctx.top_keys == NULL || ctx.top_fingerprints == NULL)
+		{
+		free(ctx.top_keys);
+		free(ctx.top_fingerprints);
+		return -1;
+		}
+
+	cifras_enum(&ctx, numbers_count, -1, NULL);
+
+	// Insertion sort, best first. Ties by fingerprint so that the order does
+	// not depend on the order of the search
+	for (i = 1; i < ctx.top_count; i++)
+		{
+		steps = solutions[i];
+		key = ctx.top_keys[i];
+		fingerprint = ctx.top_fingerprints[i];
+		for (j = i; j > 0 && (ctx.top_keys[j - 1] > key ||
+			(ctx.top_keys[j - 1] == key &&
+			ctx.top_fingerprints[j - 1] > fingerprint)); j--)
+			{
+			solutions[j] = solutions[j - 1];
+			ctx.top_keys[j] = ctx.top_keys[j - 1];
+			ctx.top_fingerprints[j] = ctx.top_fingerprints[j - 1];
+			}
+		solutions[j] = steps;
+		ctx.top_keys[j] = key;
+		ctx.top_fingerprints[j] = fingerprint;
+		}
+	free(ctx.top_keys);
+	free(ctx.top_fingerprints);
+	return ctx.top_count;
+	}
@@ -0,0 +1,47 @@
+#ifndef CIFRAS_ENUM_H
+#define CIFRAS_ENUM_H
+
+#include "cifras_bt.h"
+
+#include <stdbool.h>
+
+// Enumeration of every distinct solution of a game instead of the best one.
+//
+// Two solutions are the same if their expressions have the same normal form:
+// the operands of chains of + and - (and of * and /) are flattened into the
+// multisets of the added and the subtracted terms (multiplied and divided
+// factors), so commuted, regrouped or reordered steps count once: (8 - 2) + 4,
+// (4 + 8) - 2 and 8 + (4 - 2) are the same solution, while 4 * 5 + 4 * 3 and
+// 4 * (5 + 3) are two. Steps that do not lead to the result are left out, so
+// every solution is one expression.
+//
+// Every normal form is kept as a 64-bit fingerprint only, so the memory used
+// grows with the number of distinct solutions, not with the nodes visited.
+// Fingerprints of different normal forms collide with negligible probability.
+//
+// Same rules for the operations as cifras_bt (build_candidate). Both functions
+// are reentrant, so a game space can be split among threads.
+// numbers_count: MIN_NUM_COUNT to MAX_NUM_COUNT
+
+// Called with every distinct solution, as soon as it is found. Return false
+// to stop the enumeration. arg is the one given to resolve_cifras_all
+typedef bool (*CifrasSolutionFn)(const SolutionStepStack* steps, void* arg);
+
+// Every distinct solution that reaches target exactly, streamed to callback.
+// Return how many were found or -1 if out of memory
+long int resolve_cifras_all(const long int* numbers, int numbers_count,
+	int target, CifrasSolutionFn callback, void* arg);
+// resolve_cifras_all for every target from min_target to max_target at once
+// (the result of the steps tells the target). One enumeration costs about
+// the same as one target, so this is the way to count the solutions of a
+// whole range of targets
+long int resolve_cifras_all_targets(const long int* numbers, int numbers_count,
+	int min_target, int max_target, CifrasSolutionFn callback, void* arg);
+
+// The (up to) k distinct solutions nearest the target, fewest steps first for
+// the same distance, into solutions[0..k-1], best first. Return how many were
+// found or -1 if out of memory
+int resolve_cifras_top(const long int* numbers, int numbers_count, int target,
+	int k, SolutionStepStack* solutions);
+
+#endif
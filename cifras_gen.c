@@ -0,0 +1,206 @@
+#include "cifras_gen.h"
+#include "work_pool.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+// Puzzles generated and written at a time by cifras_gen_run
+#define GEN_BLOCK_PUZZLES 65536
+// Size of the buffer of the output stream
+#define GEN_OUTPUT_BUFFER_SIZE (1 << 20)
+// Step between the seeds of two consecutive puzzles
+#define GEN_SEED_STEP 0x9E3779B97F4A7C15ULL
+
+// Probability (percentage) that a big number shows up in a random numbers array
+#define RANDOM_BIG_NUMBER_PROBABILITY 28
+static const long int RANDOM_BIG_NUMBERS[] = {10, 25, 50, 100};
+#define RANDOM_BIG_NUMBERS_COUNT \
+	((int)(sizeof(RANDOM_BIG_NUMBERS) / sizeof(RANDOM_BIG_NUMBERS[0])))
+
+// The seed goes through splitmix64 so that close seeds (the ones of the
+// puzzles of cifras_generate) give unrelated sequences and the state is
+// never 0, which is a fixed point of xorshift
+void cifras_random_seed(uint64_t* state, uint64_t seed)
+	{
+	uint64_t x = seed + 0x9E3779B97F4A7C15ULL;
+
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	x ^= x >> 31;
+	*state = x != 0 ? x : 1;
+	}
+
+// xorshift64*
+uint64_t cifras_random(uint64_t* state)
+	{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1DULL;
+	}
+
+int cifras_random_natural(uint64_t* state, int min_val, int max_val)
+	{
+	assert(min_val <= max_val);
+	return min_val + (int)(cifras_random(state) %
+		(uint64_t)(max_val - min_val + 1));
+	}
+
+void cifras_random_numbers(uint64_t* state, long int* numbers)
+	{
+	int i;
+
+	for (i = 0; i < NUM_COUNT; i++)
+		if (cifras_random_natural(state, 0, 100) <= RANDOM_BIG_NUMBER_PROBABILITY)
+			numbers[i] = RANDOM_BIG_NUMBERS[cifras_random_natural(state, 0,
+				RANDOM_BIG_NUMBERS_COUNT - 1)];
+		else
+			numbers[i] = (long int)cifras_random_natural(state, 1, 9);
+	}
+
+bool cifras_gen_impossible(const CifrasGenConstraints* constraints)
+	{
+	assert(constraints != NULL);
+
+	if (constraints->min_steps < 0 || constraints->max_steps < 0)
+		return true;
+	// Solutions have from 1 to NUM_COUNT - 1 steps
+	if (constraints->max_steps > 0 &&
+		(constraints->solvable == CIFRAS_GEN_UNSOLVABLE ||
+		constraints->max_steps < constraints->min_steps))
+		return true;
+	return constraints->min_steps > NUM_COUNT - 1 &&
+		(constraints->solvable == CIFRAS_GEN_SOLVABLE ||
+		constraints->max_steps > 0);
+	}
+
+static bool puzzle_satisfies(const CifrasPuzzle* puzzle,
+	const CifrasGenConstraints* constraints)
+	{
+	bool exact;
+	int steps;
+
+	exact = steps_stack_result(&puzzle->steps) == (long int)puzzle->target;
+	steps = steps_stack_count(&puzzle->steps);
+	if (constraints->solvable == CIFRAS_GEN_SOLVABLE && exact == false)
+		return false;
+	if (constraints->solvable == CIFRAS_GEN_UNSOLVABLE && exact)
+		return false;
+	if (exact && steps < constraints->min_steps)
+		return false;
+	if (constraints->max_steps > 0 &&
+		(exact == false || steps > constraints->max_steps))
+		return false;
+	return true;
+	}
+
+typedef struct
+	{
+	const CifrasGenConstraints* constraints;
+	CifrasPuzzle* puzzles;
+	uint64_t seed;
+	// Set once a puzzle runs out of attempts: the rest are skipped
+	atomic_bool failed;
+	} GenJob;
+
+static void generate_puzzle(void* arg, size_t task_index, int worker_id)
+	{
+	GenJob* job = arg;
+	CifrasPuzzle* puzzle = &job->puzzles[task_index];
+	uint64_t state;
+	long int attempts;
+
+	(void)worker_id;
+	cifras_random_seed(&state, job->seed + task_index * GEN_SEED_STEP);
+	for (attempts = 0; attempts < CIFRAS_GEN_MAX_ATTEMPTS; attempts++)
+		{
+		if (atomic_load_explicit(&job->failed, memory_order_relaxed))
+			return;
+		cifras_random_numbers(&state, puzzle->numbers);
+		puzzle->target = cifras_random_natural(&state, MIN_TARGET, MAX_TARGET);
+		resolve_cifras_deepening(puzzle->numbers, NUM_COUNT, puzzle->target,
+			&puzzle->steps, NULL);
+		if (puzzle_satisfies(puzzle, job->constraints))
+			return;
+		}
+	atomic_store_explicit(&job->failed, true, memory_order_relaxed);
+	}
+
+int cifras_generate(const CifrasGenConstraints* constraints,
+	CifrasPuzzle* puzzles, size_t count, uint64_t seed, int nthreads)
+	{
+	GenJob job;
+
+	assert(constraints != NULL);
+	assert(puzzles != NULL || count == 0);
+
+	if (cifras_gen_impossible(constraints))
+		return 1;
+	job.constraints = constraints;
+	job.puzzles = puzzles;
+	job.seed = seed;
+	atomic_init(&job.failed, false);
+	if (work_pool_run(count, nthreads, generate_puzzle, &job) != 0)
+		return -1;
+	return atomic_load(&job.failed) ? 1 : 0;
+	}
+
+int cifras_gen_run(const CifrasGenConstraints* constraints, size_t count,
+	uint64_t seed, FILE* output, int nthreads)
+	{
+	CifrasPuzzle* puzzles;
+	size_t start, block, i;
+	int ret = 0, j;
+
+	assert(constraints != NULL);
+	assert(output != NULL);
+
+	if (cifras_gen_impossible(constraints))
+		{
+		fprintf(stderr, "Error in cifras_gen_run: no game satisfies the "
+			"constraints\n");
+		return 1;
+		}
+	puzzles = malloc(sizeof(CifrasPuzzle) * GEN_BLOCK_PUZZLES);
+	if (puzzles == NULL)
+		{
+		fprintf(stderr, "Error in cifras_gen_run: out of memory\n");
+		return 1;
+		}
+	setvbuf(output, NULL, _IOFBF, GEN_OUTPUT_BUFFER_SIZE);
+
+	for (start = 0; start < count && ret == 0; start += block)
+		{
+		block = count - start < GEN_BLOCK_PUZZLES ? count - start :
+			GEN_BLOCK_PUZZLES;
+		// Same puzzles as a single call with every index
+		switch (cifras_generate(constraints, puzzles, block,
+			seed + start * GEN_SEED_STEP, nthreads))
+			{
+			case -1:
+				fprintf(stderr, "Error in cifras_gen_run: out of memory\n");
+				ret = 1;
+				continue;
+			case 1:
+				fprintf(stderr, "Error in cifras_gen_run: no game found after "
+					"%d attempts\n", CIFRAS_GEN_MAX_ATTEMPTS);
+				ret = 1;
+				continue;
+			}
+		for (i = 0; i < block; i++)
+			{
+			for (j = 0; j < NUM_COUNT; j++)
+				fprintf(output, "%ld ", puzzles[i].numbers[j]);
+			fprintf(output, "%d\n", puzzles[i].target);
+			}
+		}
+
+	free(puzzles);
+	if (fflush(output) != 0)
+		{
+		perror("Error in cifras_gen_run: fflush");
+		ret = 1;
+		}
+	return ret;
+	}
@@ -0,0 +1,88 @@
+#ifndef CIFRAS_GEN_H
+#define CIFRAS_GEN_H
+
+#include "cifras_bt.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Random games and generation of games that satisfy some constraints.
+//
+// The random numbers come from a xorshift64* generator whose whole state is
+// one uint64_t owned by the caller, so every thread can keep its own one
+// without locks (unlike rand()) and a sequence of games can be reproduced
+// from its seed.
+
+// Seed state. Any seed is valid (0 included)
+void cifras_random_seed(uint64_t* state, uint64_t seed);
+uint64_t cifras_random(uint64_t* state);
+// Random number from min_val to max_val (both included)
+int cifras_random_natural(uint64_t* state, int min_val, int max_val);
+// NUM_COUNT numbers: a big number (10, 25, 50 or 100) with a probability of
+// 28%, otherwise a number from 1 to 9
+void cifras_random_numbers(uint64_t* state, long int* numbers);
+
+// Requirements of the games of cifras_generate on their shortest exact
+// solution
+typedef enum
+	{
+	// Any game
+	CIFRAS_GEN_ANY,
+	// The target can be reached
+	CIFRAS_GEN_SOLVABLE,
+	// The target cannot be reached
+	CIFRAS_GEN_UNSOLVABLE
+	} CifrasGenSolvable;
+
+typedef struct
+	{
+	CifrasGenSolvable solvable;
+	// No exact solution with fewer than min_steps steps (0: no limit). Also
+	// true for games whose target cannot be reached
+	int min_steps;
+	// An exact solution with at most max_steps steps (0: no limit)
+	int max_steps;
+	} CifrasGenConstraints;
+
+typedef struct
+	{
+	long int numbers[NUM_COUNT];
+	int target;
+	// Best solution (the shortest one if the target can be reached)
+	SolutionStepStack steps;
+	} CifrasPuzzle;
+
+// True if no game can satisfy constraints
+bool cifras_gen_impossible(const CifrasGenConstraints* constraints);
+
+// Fill puzzles[0..count-1] with random games (cifras_random_numbers and a
+// target from MIN_TARGET to MAX_TARGET) that satisfy constraints, discarding
+// the rest. Every candidate is checked with resolve_cifras_deepening, which
+// finds the shortest solutions first.
+//
+// Puzzle i only depends on seed and i, so the output is the same whatever
+// the number of threads. nthreads <= 0 means one thread per online CPU.
+//
+// Return values:
+// 0: all the puzzles generated
+// 1: some puzzle was not found after CIFRAS_GEN_MAX_ATTEMPTS candidates
+// (constraints too strict)
+// -1: out of memory
+#define CIFRAS_GEN_MAX_ATTEMPTS 1000000
+int cifras_generate(const CifrasGenConstraints* constraints,
+	CifrasPuzzle* puzzles, size_t count, uint64_t seed, int nthreads);
+
+// Generator mode: cifras_generate count puzzles and write one per line in
+// the input format of batch_run (numbers followed by the target), so the
+// output can be solved with --batch. Generated in blocks, so the memory used
+// does not depend on count.
+//
+// Return values:
+// 0: all the puzzles written
+// 1: constraints too strict, out of memory or I/O error
+int cifras_gen_run(const CifrasGenConstraints* constraints, size_t count,
+	uint64_t seed, FILE* output, int nthreads);
+
+#endif
@@ -0,0 +1,171 @@
+#include "cifras_leaf.h"
+#include "cifras_ops.h"
+
+#include <assert.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+// Lanes: the pairs (0, 1), (0, 2) and (1, 2) of the node and an unused lane
+#define LEAF_PAIRS 3
+static const int LEAF_PAIR_I[LEAF_PAIRS] = {0, 0, 1};
+static const int LEAF_PAIR_J[LEAF_PAIRS] = {1, 2, 2};
+
+bool leaf_kernel_available(void)
+	{
+	return __builtin_cpu_supports("avx2");
+	}
+
+// The 4 operations of build_candidate between the lanes of x and y.
+// results[op] and valid[op] follow the order of STEP_OPS
+__attribute__((target("avx2")))
+static inline void leaf_ops(__m256d x, __m256d y, __m256d lanes,
+	__m256d* results, __m256d* valid)
+	{
+	const __m256d one = _mm256_set1_pd(1.0);
+	__m256d high = _mm256_max_pd(x, y);
+	__m256d low = _mm256_min_pd(x, y);
+	__m256d not_one = _mm256_andnot_pd(_mm256_cmp_pd(low, one, _CMP_EQ_OQ),
+		lanes);
+	__m256d quotient = _mm256_floor_pd(_mm256_div_pd(high, low));
+
+	results[0] = _mm256_add_pd(x, y);
+	valid[0] = lanes;
+	// Subtracting equal numbers gives 0
+	results[1] = _mm256_sub_pd(high, low);
+	valid[1] = _mm256_andnot_pd(_mm256_cmp_pd(high, low, _CMP_EQ_OQ), lanes);
+	// Multiplying or dividing by 1 is useless
+	results[2] = _mm256_mul_pd(x, y);
+	valid[2] = not_one;
+	// Exact divisions only
+	results[3] = quotient;
+	valid[3] = _mm256_and_pd(not_one,
+		_mm256_cmp_pd(_mm256_mul_pd(quotient, low), high, _CMP_EQ_OQ));
+	}
+
+// (|result - target| << 8) | steps, or +inf for invalid lanes
+__attribute__((target("avx2")))
+static inline __m256d leaf_keys(__m256d results, __m256d valid,
+	__m256d target, __m256d steps)
+	{
+	const __m256d sign = _mm256_set1_pd(-0.0);
+	const __m256d shift = _mm256_set1_pd(256.0);
+	const __m256d infinity = _mm256_set1_pd(INFINITY);
+	__m256d diff = _mm256_andnot_pd(sign, _mm256_sub_pd(results, target));
+	__m256d keys = _mm256_add_pd(_mm256_mul_pd(diff, shift), steps);
+
+	return _mm256_blendv_pd(infinity, keys, valid);
+	}
+
+__attribute__((target("avx2")))
+bool leaf_kernel_best(const long int* numbers, int target, int steps_count,
+	unsigned long long best, unsigned long long* key, uint8_t* codes,
+	int* count)
+	{
+	// keys[op1]: results of one step, keys[4 + op1 * 4 + op2]: results of
+	// the step op2 between the result of op1 and the number left
+	double keys[4 + 4 * 4][4] __attribute__((aligned(32)));
+	const __m256d one = _mm256_set1_pd(1.0);
+	const __m256d lanes = _mm256_castsi256_pd(_mm256_set_epi64x(0, -1, -1, -1));
+	const __m256d target_lanes = _mm256_set1_pd((double)target);
+	const __m256d steps1 = _mm256_set1_pd((double)(steps_count + 1));
+	const __m256d steps2 = _mm256_set1_pd((double)(steps_count + 2));
+	__m256d x, y, left, results1[4], valid1[4], results2[4], valid2[4];
+	__m256d operand, minimum;
+	double lowest;
+	int op1, op2, v, lane;
+
+	assert(leaf_kernel_fits(numbers, target));
+	assert(steps_count + 2 <= MAX_SOLUTION_STEPS);
+
+	x = _mm256_set_pd(1.0, (double)numbers[1], (double)numbers[0],
+		(double)numbers[0]);
+	y = _mm256_set_pd(1.0, (double)numbers[2], (double)numbers[2],
+		(double)numbers[1]);
+	// Number left by every pair
+	left = _mm256_set_pd(1.0, (double)numbers[0], (double)numbers[1],
+		(double)numbers[2]);
+
+	leaf_ops(x, y, lanes, results1, valid1);
+	minimum = _mm256_set1_pd(INFINITY);
+	for (op1 = 0; op1 < 4; op1++)
+		{
+		_mm256_store_pd(keys[op1], leaf_keys(results1[op1], valid1[op1],
+			target_lanes, steps1));
+		minimum = _mm256_min_pd(minimum, _mm256_load_pd(keys[op1]));
+
+		// Invalid results are replaced by 1 so that the lanes stay sane
+		operand = _mm256_blendv_pd(one, results1[op1], valid1[op1]);
+		leaf_ops(operand, left, valid1[op1], results2, valid2);
+		for (op2 = 0; op2 < 4; op2++)
+			{
+			v = 4 + op1 * 4 + op2;
+			_mm256_store_pd(keys[v], leaf_keys(results2[op2], valid2[op2],
+				target_lanes, steps2));
+			minimum = _mm256_min_pd(minimum, _mm256_load_pd(keys[v]));
+			}
+		}
+
+	// Horizontal minimum
+	minimum = _mm256_min_pd(minimum, _mm256_permute4x64_pd(minimum,
+		_MM_SHUFFLE(1, 0, 3, 2)));
+	minimum = _mm256_min_pd(minimum, _mm256_permute_pd(minimum, 0x5));
+	lowest = _mm256_cvtsd_f64(minimum);
+	if (!(lowest < (double)best))
+		return false;
+
+	// Decode the winner. Same layout as cifras_bt: after the first step the
+	// numbers of the node are [result, number left] for the pairs (0, 1) and
+	// (0, 2) and [number left, result] for the pair (1, 2)
+	for (v = 0; v < 4 + 4 * 4; v++)
+		for (lane = 0; lane < LEAF_PAIRS; lane++)
+			if (keys[v][lane] == lowest)
+				{
+				*key = (unsigned long long)lowest;
+				if (v < 4)
+					{
+					codes[0] = step_code(LEAF_PAIR_I[lane], LEAF_PAIR_J[lane],
+						v);
+					*count = 1;
+					}
+				else
+					{
+					op1 = (v - 4) / 4;
+					op2 = (v - 4) % 4;
+					codes[0] = step_code(LEAF_PAIR_I[lane], LEAF_PAIR_J[lane],
+						op1);
+					codes[1] = step_code(0, 1, op2);
+					*count = 2;
+					}
+				return true;
+				}
+	assert(false);
+	return false;
+	}
+
+#else
+
+// No AVX2 outside x86: cifras_bt always uses the scalar recursion
+bool leaf_kernel_available(void)
+	{
+	return false;
+	}
+
+bool leaf_kernel_best(const long int* numbers, int target, int steps_count,
+	unsigned long long best, unsigned long long* key, uint8_t* codes,
+	int* count)
+	{
+	(void)numbers;
+	(void)target;
+	(void)steps_count;
+	(void)best;
+	(void)key;
+	(void)codes;
+	(void)count;
+	assert(false);
+	return false;
+	}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef CIFRAS_LEAF_H
+#define CIFRAS_LEAF_H
+
+// Internal header. Leaf kernel of cifras_bt: the whole subtree of a node
+// with 3 pending numbers (12 results of one step and 48 of two steps) is
+// evaluated at once with AVX2, without recursion, and reduced to its best
+// result. Only the winner is turned into step codes.
+//
+// The lanes hold doubles, exact while every value stays below 2^53, so the
+// kernel is only used when leaf_kernel_fits is true. Otherwise, or if the CPU
+// has no AVX2 (leaf_kernel_available), cifras_bt keeps the scalar recursion
+
+#include "cifras_bt.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Operands below this bound keep the two-step products and the keys
+// (distance * 2^BEST_KEY_COUNT_BITS + steps) below 2^53
+#define LEAF_MAX_OPERAND (1L << 15)
+
+// True if the CPU supports the kernel. Checked at runtime
+bool leaf_kernel_available(void);
+
+static inline bool leaf_kernel_fits(const long int* numbers, int target)
+	{
+	return numbers[0] < LEAF_MAX_OPERAND && numbers[1] < LEAF_MAX_OPERAND &&
+		numbers[2] < LEAF_MAX_OPERAND && target < LEAF_MAX_OPERAND;
+	}
+
+// Best result of the subtree of numbers[0..2], whose node is steps_count
+// steps deep. The key of a result is the one of cifras_bt:
+// (|result - target| << 8) | steps.
+// If the best key is smaller than best, return true and fill key and the
+// step codes of the path from the node (count: 1 or 2, same layout as
+// cifras_bt). Otherwise return false
+bool leaf_kernel_best(const long int* numbers, int target, int steps_count,
+	unsigned long long best, unsigned long long* key, uint8_t* codes,
+	int* count);
+
+#endif
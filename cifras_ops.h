@@ -0,0 +1,295 @@
+#ifndef CIFRAS_OPS_H
+#define CIFRAS_OPS_H
+
+// Internal header. Node expansion shared by the solver engines: which numbers
+// remain after combining a pair and which steps are worth trying for it
+
+#include "cifras_bt.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+static const char STEP_OPS[] = {'+', '-', '*', '/'};
+
+// Compact step code: operands numbers[i] and numbers[j] (i < j) of the
+// numbers array of the node and the operation (index in STEP_OPS), in one
+// byte. The steps themselves are rebuilt by replaying the codes from the
+// initial numbers (steps_stack_from_codes)
+#if MAX_NUM_COUNT * MAX_NUM_COUNT * 4 > 256
+	#error "step_code does not fit in one byte"
+#endif
+static inline uint8_t step_code(int i, int j, int op_index)
+	{
+	assert(i >= 0 && i < j && j < MAX_NUM_COUNT);
+	assert(op_index >= 0 && op_index < 4);
+	return (uint8_t)((i * MAX_NUM_COUNT + j) * 4 + op_index);
+	}
+
+// Replace the pair (i, j) of the numbers_count first numbers in place: the
+// result goes to position i and the last number to position j. Undone by
+// numbers_restore_pair
+static inline void numbers_replace_pair(long int* numbers, int numbers_count,
+	int i, int j, long int result)
+	{
+	assert(i >= 0 && i < j && j < numbers_count);
+	numbers[i] = result;
+	numbers[j] = numbers[numbers_count - 1];
+	}
+
+static inline void numbers_restore_pair(long int* numbers, int i, int j,
+	long int operand1, long int operand2)
+	{
+	numbers[j] = operand2;
+	numbers[i] = operand1;
+	}
+
+// 1. Put new in new_array[0].
+// 2. Copy the former_count elements of former_array into new array starting
+// from new_array[1] skiping former_array[old_pos1] and former_array[old_pos2]
+static inline void build_next_numbers(long int* new_array, const long int* former_array,
+	int former_count, int old_pos1, int old_pos2, long int new)
+	{
+	int i, j;
+	
+	assert(former_array != NULL);
+	assert(new_array != NULL);
+	assert(former_count <= MAX_NUM_COUNT);
+	assert(old_pos1 >= 0);
+	assert(old_pos1 < former_count);
+	assert(old_pos2 >= 0);
+	assert(old_pos2 < former_count);
+	assert(new > 0);
+
+	new_array[0] = new;
+	
+	j = 1;
+	for (i = 0; i < former_count; i++)
+		if (i != old_pos1 && i != old_pos2)
+			new_array[j++] = former_array[i];
+	}
+	
+static inline void build_candidates_stack(SolutionStepStack* stack,
+	long int operand1, long int operand2)
+	{
+	SolutionStep step;
+	
+	assert(stack != NULL);
+	assert(operand1 > 0 && operand2 > 0);
+		
+	steps_stack_init(stack);
+	
+	// Add
+	step = (SolutionStep){operand1 + operand2, operand1, operand2, '+'};
+	steps_stack_push(stack, &step);
+	
+	// Substract (no action if operand1 == operand2)
+	if (operand1 != operand2)
+		{
+		if (operand1 > operand2)
+			step = (SolutionStep){operand1 - operand2, operand1, operand2, '-'};
+		else if (operand2 > operand1)
+			step = (SolutionStep){operand2 - operand1, operand2, operand1, '-'};
+		steps_stack_push(stack, &step);
+		}
+
+	// Prune if any of the operands is 1. Either multiplying or dividing by 1
+	// introduces a useless operation.
+	//
+	// A recursive branch with a useless operation will never be the best
+	// because there will be always, at least, one branch with the same result
+	// but shorter (with less operations).
+	if (operand1 == 1 || operand2 == 1)
+		return;
+	
+	// Multiply
+	step = (SolutionStep){operand1 * operand2, operand1, operand2, '*'};
+	steps_stack_push(stack, &step);
+	
+	// Divide
+	//
+	// Optimization maximized. It is the most CPU-expensive operation.
+	//
+	// If dividend == divisor, set the result directly to 1 instead of
+	// executing the division in order to save CPU cycles
+	if (operand1 == operand2)
+		{
+		step = (SolutionStep){1, operand1, operand2, '/'};
+		steps_stack_push(stack, &step);
+		}
+	// The operands are compared before the modulo operation. That saves
+	// one modulo operation (1 vs 2) if operand1 != operand2
+	else if (operand1 > operand2 && operand1 % operand2 == 0)
+		{
+		step = (SolutionStep){operand1 / operand2, operand1, operand2, '/'};
+		steps_stack_push(stack, &step);
+		}
+	else if (operand2 > operand1 && operand2 % operand1 == 0)
+		{
+		step = (SolutionStep){operand2 / operand1, operand2, operand1, '/'};
+		steps_stack_push(stack, &step);
+		}
+	}
+
+// Same rules as build_candidates_stack for a single operation
+// (op_index: 0 '+', 1 '-', 2 '*', 3 '/'), written straight into step.
+// Return false if the operation is not worth trying for these operands
+static inline bool build_candidate(SolutionStep* step, long int operand1,
+	long int operand2, int op_index)
+	{
+	long int a, b;
+	
+	assert(step != NULL);
+	assert(operand1 > 0 && operand2 > 0);
+	
+	a = operand1 >= operand2 ? operand1 : operand2;
+	b = operand1 >= operand2 ? operand2 : operand1;
+	switch (op_index)
+		{
+		case 0:
+			*step = (SolutionStep){operand1 + operand2, operand1, operand2, '+'};
+			return true;
+		case 1:
+			if (a == b)
+				return false;
+			*step = (SolutionStep){a - b, a, b, '-'};
+			return true;
+		case 2:
+			// Multiplying or dividing by 1 is useless (build_candidates_stack)
+			if (b == 1)
+				return false;
+			*step = (SolutionStep){operand1 * operand2, operand1, operand2, '*'};
+			return true;
+		default:
+			assert(op_index == 3);
+			if (b == 1)
+				return false;
+			if (a == b)
+				*step = (SolutionStep){1, a, b, '/'};
+			else if (a % b == 0)
+				*step = (SolutionStep){a / b, a, b, '/'};
+			else
+				return false;
+			return true;
+		}
+	}
+
+// Symmetry prune of repeated operands.
+// True if numbers[pos] has the same value as any of numbers[from..pos-1].
+//
+// Only the first occurrence of every value is taken as first operand
+// (from = 0) and, after it, only the first occurrence of every value is taken
+// as second operand (from = i + 1). Every pair of values is still combined
+// once, e.g. 100, 100, 100 gives one pair (100, 100) instead of three, and
+// the skipped pairs would have produced identical subtrees
+static inline bool repeated_operand(const long int* numbers, int from, int pos)
+	{
+	int k;
+	
+	for (k = from; k < pos; k++)
+		if (numbers[k] == numbers[pos])
+			return true;
+	return false;
+	}
+
+// Commutativity prune of independent steps.
+// Two consecutive steps where the second one does not use the result of the
+// first one can be done in any order with the same numbers left, so only the
+// order where the steps are sorted by (larger operand, smaller operand,
+// operation) is explored. Equal steps are allowed in both orders.
+//
+// Every sequence of steps can be reordered into one that satisfies this
+// condition for all its consecutive independent steps (the smallest
+// topological order), so no result is lost
+static inline bool steps_out_of_order(const SolutionStep* previous,
+	const SolutionStep* next)
+	{
+	long int previous_high, previous_low, next_high, next_low;
+	
+	previous_high = previous->a >= previous->b ? previous->a : previous->b;
+	previous_low = previous->a >= previous->b ? previous->b : previous->a;
+	next_high = next->a >= next->b ? next->a : next->b;
+	next_low = next->a >= next->b ? next->b : next->a;
+	
+	if (next_high != previous_high)
+		return next_high < previous_high;
+	if (next_low != previous_low)
+		return next_low < previous_low;
+	return next->op < previous->op;
+	}
+
+// build_candidate for operands of any size: additions and multiplications
+// whose result does not fit in a long int are not tried either
+static inline bool build_candidate_wide(SolutionStep* step, long int operand1,
+	long int operand2, int op_index)
+	{
+	long int result;
+	
+	if (op_index == 0 && __builtin_add_overflow(operand1, operand2, &result))
+		return false;
+	if (op_index == 2 && __builtin_mul_overflow(operand1, operand2, &result))
+		return false;
+	return build_candidate(step, operand1, operand2, op_index);
+	}
+
+// Bound of the values of the narrow games: no step of a game whose numbers
+// multiply (1 counted as 2) up to NARROW_MAX_VALUE can reach a larger value,
+// since a + b, a * b, a - b and a / b never exceed that product. So
+// build_candidate cannot overflow and every distance to the target fits in
+// the 56 bits that the solvers keep for it. The classic games are far below
+// it (100^8 = 10^16)
+#define NARROW_MAX_VALUE ((1L << 55) - 1)
+
+static inline bool numbers_are_narrow(const long int* numbers,
+	int numbers_count)
+	{
+	long int product = 1;
+	int i;
+	
+	for (i = 0; i < numbers_count; i++)
+		if (__builtin_mul_overflow(product, numbers[i] == 1 ? 2 : numbers[i],
+			&product) || product > NARROW_MAX_VALUE)
+			return false;
+	return true;
+	}
+
+// Apply the operation op to operand1 and operand2 the same way
+// build_candidate does: the larger operand goes first in subtractions and
+// divisions
+static inline void step_apply(SolutionStep* step, long int operand1,
+	long int operand2, int op_index)
+	{
+	bool valid;
+	
+	valid = build_candidate(step, operand1, operand2, op_index);
+	assert(valid);
+	(void)valid;
+	}
+
+// Append to stack the steps coded with step_code, replaying them in place
+// (numbers_replace_pair) from the numbers_count first numbers
+static inline void steps_stack_from_codes(SolutionStepStack* stack,
+	const long int* numbers, int numbers_count, const uint8_t* codes, int count)
+	{
+	long int current[MAX_NUM_COUNT];
+	SolutionStep step;
+	int k, i, j, pair;
+	
+	assert(numbers != NULL);
+	assert(numbers_count > count);
+	assert(count >= 0 && count <= MAX_SOLUTION_STEPS);
+	
+	for (k = 0; k < numbers_count; k++)
+		current[k] = numbers[k];
+	for (k = 0; k < count; k++)
+		{
+		pair = codes[k] / 4;
+		i = pair / MAX_NUM_COUNT;
+		j = pair % MAX_NUM_COUNT;
+		step_apply(&step, current[i], current[j], codes[k] % 4);
+		steps_stack_push(stack, &step);
+		numbers_replace_pair(current, numbers_count - k, i, j, step.result);
+		}
+	}
+
+#endif
@@ -0,0 +1,62 @@
+#include "cifras_parse.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+static inline bool is_digit(char c)
+	{
+	return (unsigned char)(c - '0') <= 9;
+	}
+
+int cifras_parse_values(const char* begin, const char* end, long int* values,
+	int max_values, int* count)
+	{
+	const char* p = begin;
+	const char* start;
+	long int value;
+	int parsed = 0;
+	bool comma;
+
+	assert(begin != NULL && begin <= end);
+	assert(values != NULL || max_values == 0);
+	assert(count != NULL);
+
+	*count = 0;
+	while (p < end && cifras_parse_is_blank(*p))
+		p++;
+	while (p < end)
+		{
+		// Leading zeros are not significant
+		while (*p == '0' && p + 1 < end && p[1] == '0')
+			p++;
+		if (*p == '0' && p + 1 < end && is_digit(p[1]))
+			p++;
+		start = p;
+		value = 0;
+		while (p < end && is_digit(*p))
+			{
+			if (p - start == CIFRAS_PARSE_MAX_DIGITS)
+				return 2;
+			value = value * 10 + (*p++ - '0');
+			}
+		if (p == start)
+			return 1;
+		if (parsed == max_values)
+			return 1;
+		values[parsed++] = value;
+		*count = parsed;
+
+		// Separator, mandatory between values. A comma cannot end the line
+		comma = false;
+		start = p;
+		while (p < end && (cifras_parse_is_blank(*p) ||
+			(*p == ',' && comma == false)))
+			comma |= *p++ == ',';
+		if (p == end)
+			return comma ? 1 : 0;
+		if (p == start)
+			return 1;
+		}
+	return 0;
+	}
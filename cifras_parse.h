@@ -0,0 +1,33 @@
+#ifndef CIFRAS_PARSE_H
+#define CIFRAS_PARSE_H
+
+// Single-pass, allocation-free parser of the lines of the games, shared by
+// the interactive, batch and server modes.
+//
+// A line is a list of unsigned decimal values separated with blanks or with
+// a single comma (blanks around it allowed), with optional blanks at the
+// beginning and the end. Blanks are the [[:space:]] characters but the
+// new-line, which ends the line. It is the grammar of the regular
+// expressions that used to validate the interactive input, except that zero
+// values are accepted here and left to the range checks of the caller.
+
+#include <stdbool.h>
+
+// Values with more digits are not converted in order to avoid overflows
+#define CIFRAS_PARSE_MAX_DIGITS 9
+
+static inline bool cifras_parse_is_blank(char c)
+	{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+	}
+
+// Parse [begin, end) into values (max_values at most) and count (0 if the
+// line is blank).
+// Return values:
+// 0: line parsed
+// 1: wrong format (including more than max_values values)
+// 2: a value has more than CIFRAS_PARSE_MAX_DIGITS digits
+int cifras_parse_values(const char* begin, const char* end, long int* values,
+	int max_values, int* count);
+
+#endif
@@ -0,0 +1,117 @@
+#include "cifras_reach.h"
+#include "cifras_ops.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Record every step result in the table. Unlike cifras_bt there is no
+// target, so the only prunes are the ones of build_candidate. numbers is
+// modified in place (numbers_replace_pair) and restored before returning
+static void reach_bt(long int* numbers, int numbers_count, uint8_t* codes,
+	int depth, ReachTable* table)
+	{
+	int i, j, op;
+	long int operand1, operand2;
+	SolutionStep candidate;
+	ReachEntry* entry;
+
+	assert(numbers_count > 1);
+	assert(depth < NUM_COUNT - 1);
+
+	for (i = 0; i < numbers_count; i++)
+		for (j = i + 1; j < numbers_count; j++)
+			{
+			operand1 = numbers[i];
+			operand2 = numbers[j];
+			for (op = 3; op >= 0; op--)
+				{
+				if (build_candidate(&candidate, operand1, operand2, op) == false)
+					continue;
+				codes[depth] = step_code(i, j, op);
+
+				if (candidate.result < REACH_TABLE_SIZE)
+					{
+					entry = &table->values[candidate.result];
+					if (entry->count == 0 || depth + 1 < entry->count)
+						{
+						entry->count = (uint8_t)(depth + 1);
+						memcpy(entry->codes, codes, depth + 1);
+						}
+					}
+
+				if (numbers_count > 2)
+					{
+					numbers_replace_pair(numbers, numbers_count, i, j,
+						candidate.result);
+					reach_bt(numbers, numbers_count - 1, codes, depth + 1, table);
+					numbers_restore_pair(numbers, i, j, operand1, operand2);
+					}
+				}
+			}
+	}
+
+// Pick for target the reachable value nearest to it and, among the ones at
+// the same distance, the one with less steps
+static int16_t best_value(const ReachTable* table, int target)
+	{
+	int diff, value, best = -1;
+	const ReachEntry* entry;
+
+	for (diff = 0; target + diff < REACH_TABLE_SIZE; diff++)
+		{
+		value = target - diff;
+		if (value > 0 && table->values[value].count != 0)
+			best = value;
+
+		value = target + diff;
+		entry = &table->values[value];
+		if (entry->count != 0 && (best < 0 ||
+			entry->count < table->values[best].count))
+			best = value;
+
+		if (best >= 0)
+			return (int16_t)best;
+		}
+
+	// See REACH_TABLE_SIZE
+	assert(false);
+	return -1;
+	}
+
+void cifras_reachable_all(const long int* numbers, ReachTable* table)
+	{
+	uint8_t codes[NUM_COUNT - 1];
+	long int current[NUM_COUNT];
+	int i;
+
+	assert(numbers != NULL);
+	assert(table != NULL);
+
+	memset(table->values, 0, sizeof(table->values));
+	for (i = 0; i < NUM_COUNT; i++)
+		{
+		table->numbers[i] = numbers[i];
+		current[i] = numbers[i];
+		}
+
+	reach_bt(current, NUM_COUNT, codes, 0, table);
+
+	for (i = 0; i < REACH_TARGET_COUNT; i++)
+		table->best[i] = best_value(table, MIN_TARGET + i);
+	}
+
+void reach_table_lookup(const ReachTable* table, int target,
+	SolutionStepStack* best_steps)
+	{
+	const ReachEntry* entry;
+
+	assert(table != NULL);
+	assert(best_steps != NULL);
+	assert(target >= MIN_TARGET && target <= MAX_TARGET);
+
+	entry = &table->values[table->best[target - MIN_TARGET]];
+	steps_stack_init(best_steps);
+	steps_stack_from_codes(best_steps, table->numbers, NUM_COUNT, entry->codes,
+		entry->count);
+	}
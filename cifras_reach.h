@@ -0,0 +1,48 @@
+#ifndef CIFRAS_REACH_H
+#define CIFRAS_REACH_H
+
+#include "cifras_bt.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Values recorded by cifras_reachable_all: 0..REACH_TABLE_SIZE-1.
+// The best result for any target between MIN_TARGET and MAX_TARGET is always
+// below 2 * MAX_TARGET: the first step alone reaches either a value below the
+// target (distance < target) or the sum of two numbers (at most 2 * MAX_NUMBER)
+#define REACH_TABLE_SIZE (2 * MAX_TARGET)
+#define REACH_TARGET_COUNT (MAX_TARGET - MIN_TARGET + 1)
+
+#if 2 * MAX_NUMBER >= REACH_TABLE_SIZE
+	#error "REACH_TABLE_SIZE does not cover the results of every target"
+#endif
+
+// Shortest way of reaching a value. count == 0 if it is not reachable.
+// codes are built with step_code (cifras_ops.h). The table only covers games
+// of NUM_COUNT numbers
+typedef struct
+	{
+	uint8_t count;
+	uint8_t codes[NUM_COUNT - 1];
+	} ReachEntry;
+
+typedef struct
+	{
+	long int numbers[NUM_COUNT];
+	ReachEntry values[REACH_TABLE_SIZE];
+	// Value of the best result for every target (index target - MIN_TARGET)
+	int16_t best[REACH_TARGET_COUNT];
+	} ReachTable;
+
+// Walk the whole expression tree of numbers once and fill table with the
+// shortest steps reaching every value and the best result of every target.
+// The best results are the same as the ones of resolve_cifras (same result
+// distance and steps count)
+void cifras_reachable_all(const long int* numbers, ReachTable* table);
+
+// O(1) answer of resolve_cifras(table->numbers, target, best_steps)
+// target must be between MIN_TARGET and MAX_TARGET
+void reach_table_lookup(const ReachTable* table, int target,
+	SolutionStepStack* best_steps);
+
+#endif
@@ -0,0 +1,968 @@
+#include "cifras_serve.h"
+#include "cifras_batch.h"
+#include "cifras_bt.h"
+#include "work_pool.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Events handled per epoll_wait
+#define SERVE_MAX_EVENTS 64
+// Bytes read per read call
+#define SERVE_READ_SIZE 65536
+// Back-pressure: a connection is not read while it has this many requests
+// without reply or this many bytes of replies not sent yet
+#define SERVE_MAX_PENDING 4096
+#define SERVE_MAX_OUTPUT (1 << 20)
+#define SERVE_LISTEN_BACKLOG 128
+// Latency histogram: bucket i holds latencies below 2^i microseconds
+#define SERVE_LATENCY_BUCKETS 40
+// Buffer size of serve_client
+#define CLIENT_BUFFER_SIZE 65536
+
+typedef struct ServeConnection ServeConnection;
+
+typedef struct ServeRequest
+	{
+	ServeConnection* connection;
+	// Next request of the connection, in arrival order
+	struct ServeRequest* next;
+	// Next request of the queue or of the completed list
+	struct ServeRequest* next_job;
+	BatchGame game;
+	uint64_t received_ns;
+	// Reply ready to be sent
+	bool done;
+	int reply_length;
+	char reply[BATCH_MAX_LINE];
+	} ServeRequest;
+
+struct ServeConnection
+	{
+	// -1 once closed. The connection is freed when it has no requests in the
+	// workers either
+	int fd;
+	// Set when closed so that the workers skip its games
+	atomic_bool closed;
+	// Every connection of the server
+	ServeConnection* prev;
+	ServeConnection* next;
+	// Requests without reply sent, in arrival order
+	ServeRequest* head;
+	ServeRequest* tail;
+	int pending;
+	// Requests in the queue or in the workers
+	int in_flight;
+	// Beginning of a line split between reads
+	char line[SERVE_MAX_LINE];
+	size_t line_length;
+	bool line_too_long;
+	// Replies not sent yet: output[output_start..output_length-1]
+	char* output;
+	size_t output_start;
+	size_t output_length;
+	size_t output_size;
+	// End of the input: closed once every reply is sent
+	bool input_closed;
+	// Replies added since the last write
+	bool dirty;
+	ServeConnection* next_dirty;
+	uint32_t events;
+	};
+
+typedef struct
+	{
+	int listen_fd;
+	int epoll_fd;
+	// Written by the workers to wake the event loop up
+	int event_fd;
+	const BatchConfig* config;
+
+	// Shared with the workers, protected by mutex
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty;
+	ServeRequest* queue_head;
+	ServeRequest* queue_tail;
+	size_t queued;
+	ServeRequest* completed;
+	bool stopping;
+
+	// Owned by the event loop
+	ServeConnection* connections;
+	ServeConnection* dirty;
+	// Requests parsed but not yet queued (queued at once by server_submit)
+	ServeRequest* submit_head;
+	ServeRequest* submit_tail;
+	size_t submit_count;
+	int connection_count;
+	size_t max_queued;
+	size_t in_flight;
+	unsigned long long requests;
+	unsigned long long errors;
+	unsigned long long solved;
+	uint64_t latency_total_ns;
+	uint64_t latency_max_ns;
+	unsigned long long latency_buckets[SERVE_LATENCY_BUCKETS];
+	} Server;
+
+static volatile sig_atomic_t serve_stop;
+
+static void serve_signal(int signal_number)
+	{
+	(void)signal_number;
+	serve_stop = 1;
+	}
+
+static void* serve_worker(void* arg)
+	{
+	Server* server = arg;
+	ServeRequest* request;
+	uint64_t one = 1;
+	bool wake;
+
+	for (;;)
+		{
+		pthread_mutex_lock(&server->mutex);
+		while (server->queue_head == NULL && server->stopping == false)
+			pthread_cond_wait(&server->not_empty, &server->mutex);
+		if (server->stopping)
+			{
+			pthread_mutex_unlock(&server->mutex);
+			return NULL;
+			}
+		request = server->queue_head;
+		server->queue_head = request->next_job;
+		server->queued--;
+		pthread_mutex_unlock(&server->mutex);
+
+		if (atomic_load_explicit(&request->connection->closed,
+			memory_order_relaxed) == false)
+			{
+			batch_solve_game(&request->game, server->config);
+			request->reply_length = batch_format_game(&request->game,
+				request->reply);
+			}
+
+		// The event loop takes the whole list at once, so only the first
+		// request of the list needs to wake it up
+		pthread_mutex_lock(&server->mutex);
+		wake = server->completed == NULL;
+		request->next_job = server->completed;
+		server->completed = request;
+		pthread_mutex_unlock(&server->mutex);
+		if (wake && write(server->event_fd, &one, sizeof(one)) < 0)
+			perror("Error in serve_worker: write");
+		}
+	}
+
+static void server_stats(Server* server, char* line, size_t line_size)
+	{
+	unsigned long long count = 0;
+	double p99_us = 0.0;
+	CifrasCacheStats cache_stats;
+	size_t queued;
+	int i, length;
+
+	pthread_mutex_lock(&server->mutex);
+	queued = server->queued;
+	pthread_mutex_unlock(&server->mutex);
+	// Upper bound of the bucket of the 99th percentile, which may be above
+	// the maximum latency seen
+	for (i = 0; i < SERVE_LATENCY_BUCKETS && server->solved > 0; i++)
+		{
+		count += server->latency_buckets[i];
+		if (count * 100 >= server->solved * 99)
+			{
+			p99_us = (double)(1ULL << i);
+			break;
+			}
+		}
+	if (p99_us > server->latency_max_ns / 1000.0)
+		p99_us = server->latency_max_ns / 1000.0;
+	length = snprintf(line, line_size, "stats connections=%d queued=%zu "
+		"max_queued=%zu in_flight=%zu requests=%llu errors=%llu "
+		"latency_avg_us=%.1f latency_p99_us=%.1f latency_max_us=%.1f",
+		server->connection_count, queued, server->max_queued,
+		server->in_flight, server->requests, server->errors,
+		server->solved > 0 ?
+		(double)server->latency_total_ns / server->solved / 1000.0 : 0.0,
+		p99_us, server->latency_max_ns / 1000.0);
+	if (server->config->cache != NULL)
+		{
+		cifras_cache_stats(server->config->cache, &cache_stats);
+		length += snprintf(line + length, line_size - length, " cache_hits=%llu "
+			"cache_misses=%llu cache_evictions=%llu", cache_stats.hits,
+			cache_stats.misses, cache_stats.evictions);
+		}
+	snprintf(line + length, line_size - length, "\n");
+	}
+
+static void server_latency(Server* server, uint64_t latency_ns)
+	{
+	uint64_t us = latency_ns / 1000;
+	int bucket = 0;
+
+	while (bucket < SERVE_LATENCY_BUCKETS - 1 && us >= (1ULL << bucket))
+		bucket++;
+	server->latency_buckets[bucket]++;
+	server->latency_total_ns += latency_ns;
+	if (latency_ns > server->latency_max_ns)
+		server->latency_max_ns = latency_ns;
+	server->solved++;
+	}
+
+// Queue the requests parsed since the last call with a single lock
+static void server_submit(Server* server)
+	{
+	if (server->submit_count == 0)
+		return;
+	pthread_mutex_lock(&server->mutex);
+	if (server->queue_head == NULL)
+		server->queue_head = server->submit_head;
+	else
+		server->queue_tail->next_job = server->submit_head;
+	server->queue_tail = server->submit_tail;
+	server->queued += server->submit_count;
+	if (server->queued > server->max_queued)
+		server->max_queued = server->queued;
+	if (server->submit_count == 1)
+		pthread_cond_signal(&server->not_empty);
+	else
+		pthread_cond_broadcast(&server->not_empty);
+	pthread_mutex_unlock(&server->mutex);
+	server->submit_head = NULL;
+	server->submit_tail = NULL;
+	server->submit_count = 0;
+	}
+
+static void connection_mark_dirty(Server* server, ServeConnection* connection)
+	{
+	if (connection->dirty)
+		return;
+	connection->dirty = true;
+	connection->next_dirty = server->dirty;
+	server->dirty = connection;
+	}
+
+static void connection_free(Server* server, ServeConnection* connection)
+	{
+	ServeRequest* request;
+
+	assert(connection->fd < 0);
+	assert(connection->in_flight == 0);
+	while (connection->head != NULL)
+		{
+		request = connection->head;
+		connection->head = request->next;
+		free(request);
+		}
+	if (connection->prev != NULL)
+		connection->prev->next = connection->next;
+	else
+		server->connections = connection->next;
+	if (connection->next != NULL)
+		connection->next->prev = connection->prev;
+	free(connection->output);
+	free(connection);
+	}
+
+// Stop reading and writing. The connection is freed by server_flush or, if
+// some of its requests are still in the workers, when the last one is
+// completed
+static void connection_close(Server* server, ServeConnection* connection)
+	{
+	if (connection->fd < 0)
+		return;
+	close(connection->fd);
+	connection->fd = -1;
+	atomic_store_explicit(&connection->closed, true, memory_order_relaxed);
+	server->connection_count--;
+	}
+
+// Move the replies ready at the head of the connection to its output
+static void connection_collect(Server* server, ServeConnection* connection)
+	{
+	ServeRequest* request;
+	size_t size;
+	char* output;
+
+	while (connection->head != NULL && connection->head->done)
+		{
+		request = connection->head;
+		if (connection->output_length + request->reply_length >
+			connection->output_size)
+			{
+			// Sent bytes are discarded before growing the buffer
+			memmove(connection->output, connection->output +
+				connection->output_start, connection->output_length -
+				connection->output_start);
+			connection->output_length -= connection->output_start;
+			connection->output_start = 0;
+			size = connection->output_size > 0 ? connection->output_size :
+				SERVE_READ_SIZE;
+			while (connection->output_length + request->reply_length > size)
+				size *= 2;
+			if (size != connection->output_size)
+				{
+				output = realloc(connection->output, size);
+				if (output == NULL)
+					{
+					fprintf(stderr, "Error in connection_collect: out of "
+						"memory\n");
+					connection_close(server, connection);
+					return;
+					}
+				connection->output = output;
+				connection->output_size = size;
+				}
+			}
+		memcpy(connection->output + connection->output_length, request->reply,
+			request->reply_length);
+		connection->output_length += request->reply_length;
+		connection->head = request->next;
+		if (connection->head == NULL)
+			connection->tail = NULL;
+		connection->pending--;
+		free(request);
+		}
+	}
+
+static void connection_add(Server* server, ServeConnection* connection,
+	ServeRequest* request)
+	{
+	request->connection = connection;
+	request->next = NULL;
+	request->next_job = NULL;
+	if (connection->tail == NULL)
+		connection->head = request;
+	else
+		connection->tail->next = request;
+	connection->tail = request;
+	connection->pending++;
+	if (request->done)
+		{
+		connection_mark_dirty(server, connection);
+		return;
+		}
+	request->received_ns = cifras_now_ns();
+	connection->in_flight++;
+	server->in_flight++;
+	if (server->submit_tail == NULL)
+		server->submit_head = request;
+	else
+		server->submit_tail->next_job = request;
+	server->submit_tail = request;
+	server->submit_count++;
+	}
+
+// One request line [begin, end) without the new-line
+static void connection_line(Server* server, ServeConnection* connection,
+	const char* begin, const char* end, bool too_long)
+	{
+	ServeRequest* request;
+
+	while (begin < end && (*begin == ' ' || *begin == '\t' || *begin == '\r'))
+		begin++;
+	while (end > begin && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+		end--;
+	if (begin == end && too_long == false)
+		return;
+	request = malloc(sizeof(ServeRequest));
+	if (request == NULL)
+		{
+		// The replies of the previous requests are still sent
+		fprintf(stderr, "Error in connection_line: out of memory\n");
+		connection->input_closed = true;
+		return;
+		}
+	request->done = true;
+	if (too_long == false && end - begin == 5 && memcmp(begin, "stats", 5) == 0)
+		{
+		// Not counted as a game
+		server_stats(server, request->reply, sizeof(request->reply));
+		request->reply_length = (int)strlen(request->reply);
+		connection_add(server, connection, request);
+		return;
+		}
+	server->requests++;
+	if (too_long)
+		{
+		request->game.error = "line too long";
+		request->game.error_value = -1;
+		}
+	else
+		batch_parse_game(begin, end, server->config->wide, &request->game);
+	if (request->game.error != NULL)
+		{
+		server->errors++;
+		request->reply_length = batch_format_game(&request->game,
+			request->reply);
+		}
+	else
+		request->done = false;
+	connection_add(server, connection, request);
+	}
+
+// Split the bytes received into lines
+static void connection_input(Server* server, ServeConnection* connection,
+	const char* data, size_t size)
+	{
+	const char* end = data + size;
+	const char* newline;
+	size_t length;
+
+	while (data < end)
+		{
+		newline = memchr(data, '\n', end - data);
+		length = (size_t)((newline != NULL ? newline : end) - data);
+		// Whole line in data: parsed in place
+		if (newline != NULL && connection->line_length == 0 &&
+			connection->line_too_long == false)
+			{
+			connection_line(server, connection, data, newline,
+				length > SERVE_MAX_LINE);
+			data = newline + 1;
+			continue;
+			}
+		if (connection->line_length + length > SERVE_MAX_LINE)
+			connection->line_too_long = true;
+		else if (connection->line_too_long == false)
+			{
+			memcpy(connection->line + connection->line_length, data, length);
+			connection->line_length += length;
+			}
+		if (newline == NULL)
+			break;
+		connection_line(server, connection, connection->line,
+			connection->line + connection->line_length,
+			connection->line_too_long);
+		connection->line_length = 0;
+		connection->line_too_long = false;
+		data = newline + 1;
+		}
+	}
+
+// Register the events the connection is waiting for. Close it if it is done
+static void connection_update(Server* server, ServeConnection* connection)
+	{
+	struct epoll_event event;
+	uint32_t events = 0;
+
+	if (connection->fd < 0)
+		return;
+	if (connection->input_closed && connection->head == NULL &&
+		connection->output_start == connection->output_length)
+		{
+		connection_close(server, connection);
+		return;
+		}
+	if (connection->input_closed == false &&
+		connection->pending < SERVE_MAX_PENDING &&
+		connection->output_length - connection->output_start < SERVE_MAX_OUTPUT)
+		events |= EPOLLIN;
+	if (connection->output_start < connection->output_length)
+		events |= EPOLLOUT;
+	if (events == connection->events)
+		return;
+	event.events = events;
+	event.data.ptr = connection;
+	if (epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, connection->fd, &event) != 0)
+		{
+		perror("Error in connection_update: epoll_ctl");
+		connection_close(server, connection);
+		return;
+		}
+	connection->events = events;
+	}
+
+static void connection_read(Server* server, ServeConnection* connection)
+	{
+	char buffer[SERVE_READ_SIZE];
+	ssize_t size;
+
+	size = read(connection->fd, buffer, sizeof(buffer));
+	if (size < 0)
+		{
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return;
+		connection_close(server, connection);
+		return;
+		}
+	if (size == 0)
+		{
+		// A last line without new-line is a request too
+		if (connection->line_length > 0 || connection->line_too_long)
+			connection_line(server, connection, connection->line,
+				connection->line + connection->line_length,
+				connection->line_too_long);
+		connection->line_length = 0;
+		connection->line_too_long = false;
+		connection->input_closed = true;
+		server_submit(server);
+		return;
+		}
+	connection_input(server, connection, buffer, (size_t)size);
+	server_submit(server);
+	}
+
+// Send as many replies as possible, all of them with a single send if the
+// socket accepts them
+static void connection_write(Server* server, ServeConnection* connection)
+	{
+	ssize_t size;
+
+	while (connection->output_start < connection->output_length)
+		{
+		size = send(connection->fd, connection->output +
+			connection->output_start, connection->output_length -
+			connection->output_start, MSG_NOSIGNAL);
+		if (size < 0)
+			{
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				break;
+			connection_close(server, connection);
+			return;
+			}
+		connection->output_start += (size_t)size;
+		}
+	if (connection->output_start == connection->output_length)
+		{
+		connection->output_start = 0;
+		connection->output_length = 0;
+		}
+	}
+
+static void server_accept(Server* server)
+	{
+	ServeConnection* connection;
+	struct epoll_event event;
+	int fd;
+
+	for (;;)
+		{
+		fd = accept(server->listen_fd, NULL, NULL);
+		if (fd < 0)
+			{
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				perror("Error in server_accept: accept");
+			return;
+			}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		connection = calloc(1, sizeof(ServeConnection));
+		if (connection == NULL)
+			{
+			fprintf(stderr, "Error in server_accept: out of memory\n");
+			close(fd);
+			continue;
+			}
+		connection->fd = fd;
+		connection->events = EPOLLIN;
+		event.events = EPOLLIN;
+		event.data.ptr = connection;
+		if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+			{
+			perror("Error in server_accept: epoll_ctl");
+			close(fd);
+			free(connection);
+			continue;
+			}
+		connection->next = server->connections;
+		if (server->connections != NULL)
+			server->connections->prev = connection;
+		server->connections = connection;
+		server->connection_count++;
+		}
+	}
+
+// Take the requests solved by the workers
+static void server_completed(Server* server)
+	{
+	ServeRequest* request;
+	ServeRequest* next;
+	ServeConnection* connection;
+	uint64_t value, now;
+
+	if (read(server->event_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+		perror("Error in server_completed: read");
+	pthread_mutex_lock(&server->mutex);
+	request = server->completed;
+	server->completed = NULL;
+	pthread_mutex_unlock(&server->mutex);
+
+	now = cifras_now_ns();
+	for (; request != NULL; request = next)
+		{
+		next = request->next_job;
+		connection = request->connection;
+		server_latency(server, now - request->received_ns);
+		request->done = true;
+		server->in_flight--;
+		connection->in_flight--;
+		if (connection->fd < 0)
+			{
+			if (connection->in_flight == 0 && connection->dirty == false)
+				connection_free(server, connection);
+			continue;
+			}
+		connection_mark_dirty(server, connection);
+		}
+	}
+
+// Write the replies collected in this iteration of the event loop
+static void server_flush(Server* server)
+	{
+	ServeConnection* connection;
+
+	while (server->dirty != NULL)
+		{
+		connection = server->dirty;
+		server->dirty = connection->next_dirty;
+		if (connection->fd >= 0)
+			connection_collect(server, connection);
+		if (connection->fd >= 0)
+			connection_write(server, connection);
+		if (connection->fd >= 0)
+			connection_update(server, connection);
+		connection->dirty = false;
+		if (connection->fd < 0 && connection->in_flight == 0)
+			connection_free(server, connection);
+		}
+	}
+
+static int server_listen(Server* server, const char* socket_path)
+	{
+	struct sockaddr_un address = {0};
+	struct stat st;
+
+	if (strlen(socket_path) >= sizeof(address.sun_path))
+		{
+		fprintf(stderr, "Error in serve_run: socket path too long\n");
+		return 1;
+		}
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socket_path);
+	// Socket of a previous run
+	if (stat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(socket_path);
+
+	server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK |
+		SOCK_CLOEXEC, 0);
+	if (server->listen_fd < 0)
+		{
+		perror("Error in serve_run: socket");
+		return 1;
+		}
+	if (bind(server->listen_fd, (struct sockaddr*)&address,
+		sizeof(address)) != 0)
+		{
+		perror("Error in serve_run: bind");
+		return 1;
+		}
+	if (listen(server->listen_fd, SERVE_LISTEN_BACKLOG) != 0)
+		{
+		perror("Error in serve_run: listen");
+		unlink(socket_path);
+		return 1;
+		}
+	return 0;
+	}
+
+static void server_loop(Server* server)
+	{
+	struct epoll_event events[SERVE_MAX_EVENTS];
+	ServeConnection* connection;
+	int count, i;
+
+	while (serve_stop == 0)
+		{
+		count = epoll_wait(server->epoll_fd, events, SERVE_MAX_EVENTS, -1);
+		if (count < 0)
+			{
+			if (errno != EINTR)
+				{
+				perror("Error in serve_run: epoll_wait");
+				break;
+				}
+			continue;
+			}
+		for (i = 0; i < count; i++)
+			{
+			if (events[i].data.ptr == NULL)
+				server_accept(server);
+			else if (events[i].data.ptr == &server->event_fd)
+				server_completed(server);
+			else
+				{
+				// Dirty before anything else, so that a connection closed
+				// here is not freed until server_flush
+				connection = events[i].data.ptr;
+				if (connection->fd < 0)
+					continue;
+				connection_mark_dirty(server, connection);
+				// Both sides shut down: nobody to send the replies to
+				if (connection->input_closed &&
+					(events[i].events & (EPOLLHUP | EPOLLERR)))
+					connection_close(server, connection);
+				else if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+					connection_read(server, connection);
+				}
+			}
+		server_flush(server);
+		}
+	}
+
+int serve_run(const char* socket_path, int nthreads,
+	const BatchConfig* config)
+	{
+	Server server = {0};
+	struct epoll_event event;
+	struct sigaction action = {0};
+	sigset_t signals, old_signals;
+	pthread_t* workers;
+	char stats[BATCH_MAX_LINE];
+	int i, started = 0, ret = 1;
+
+	assert(socket_path != NULL);
+	assert(config != NULL);
+
+	if (nthreads <= 0)
+		nthreads = work_pool_default_threads();
+	server.listen_fd = -1;
+	server.epoll_fd = -1;
+	server.event_fd = -1;
+	server.config = config;
+	pthread_mutex_init(&server.mutex, NULL);
+	pthread_cond_init(&server.not_empty, NULL);
+	workers = malloc(sizeof(pthread_t) * nthreads);
+	if (workers == NULL)
+		{
+		fprintf(stderr, "Error in serve_run: out of memory\n");
+		goto end;
+		}
+
+	if (server_listen(&server, socket_path) != 0)
+		goto end;
+	server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	server.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (server.epoll_fd < 0 || server.event_fd < 0)
+		{
+		perror("Error in serve_run: epoll_create1/eventfd");
+		goto end_unlink;
+		}
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	if (epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &event) != 0)
+		{
+		perror("Error in serve_run: epoll_ctl");
+		goto end_unlink;
+		}
+	event.data.ptr = &server.event_fd;
+	if (epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.event_fd, &event) != 0)
+		{
+		perror("Error in serve_run: epoll_ctl");
+		goto end_unlink;
+		}
+
+	// Without SA_RESTART, so that the signals interrupt epoll_wait. They are
+	// blocked in the workers in order to always reach the event loop
+	serve_stop = 0;
+	action.sa_handler = serve_signal;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+	for (started = 0; started < nthreads; started++)
+		if (pthread_create(&workers[started], NULL, serve_worker, &server) != 0)
+			break;
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+	if (started == 0)
+		{
+		fprintf(stderr, "Error in serve_run: pthread_create\n");
+		goto end_unlink;
+		}
+
+	server_loop(&server);
+	ret = serve_stop != 0 ? 0 : 1;
+
+	// Pending games are dropped
+	pthread_mutex_lock(&server.mutex);
+	server.stopping = true;
+	pthread_cond_broadcast(&server.not_empty);
+	pthread_mutex_unlock(&server.mutex);
+	for (i = 0; i < started; i++)
+		pthread_join(workers[i], NULL);
+	server_stats(&server, stats, sizeof(stats));
+	fputs(stats, stderr);
+
+	// Every request, queued or not, belongs to the list of its connection
+	while (server.connections != NULL)
+		{
+		connection_close(&server, server.connections);
+		server.connections->in_flight = 0;
+		connection_free(&server, server.connections);
+		}
+
+end_unlink:
+	unlink(socket_path);
+end:
+	if (server.listen_fd >= 0)
+		close(server.listen_fd);
+	if (server.epoll_fd >= 0)
+		close(server.epoll_fd);
+	if (server.event_fd >= 0)
+		close(server.event_fd);
+	pthread_cond_destroy(&server.not_empty);
+	pthread_mutex_destroy(&server.mutex);
+	free(workers);
+	return ret;
+	}
+
+static int write_all(int fd, const char* data, size_t size)
+	{
+	ssize_t written;
+
+	while (size > 0)
+		{
+		written = write(fd, data, size);
+		if (written < 0)
+			{
+			if (errno == EINTR)
+				continue;
+			return 1;
+			}
+		data += written;
+		size -= (size_t)written;
+		}
+	return 0;
+	}
+
+int serve_client(const char* socket_path)
+	{
+	struct sockaddr_un address = {0};
+	struct pollfd fds[2];
+	char input[CLIENT_BUFFER_SIZE];
+	char output[CLIENT_BUFFER_SIZE];
+	size_t input_start = 0, input_length = 0;
+	bool input_eof = false;
+	ssize_t size;
+	int fd, ret = 1;
+
+	assert(socket_path != NULL);
+
+	if (strlen(socket_path) >= sizeof(address.sun_path))
+		{
+		fprintf(stderr, "Error in serve_client: socket path too long\n");
+		return 1;
+		}
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socket_path);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		{
+		perror("Error in serve_client: socket");
+		return 1;
+		}
+	if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0)
+		{
+		perror("Error in serve_client: connect");
+		close(fd);
+		return 1;
+		}
+	// Non-blocking: the client must keep reading replies while the server
+	// does not accept more requests
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	signal(SIGPIPE, SIG_IGN);
+
+	for (;;)
+		{
+		fds[0].fd = fd;
+		fds[0].events = POLLIN | (input_start < input_length ? POLLOUT : 0);
+		fds[1].fd = input_eof || input_start < input_length ? -1 : STDIN_FILENO;
+		fds[1].events = POLLIN;
+		if (poll(fds, 2, -1) < 0)
+			{
+			if (errno == EINTR)
+				continue;
+			perror("Error in serve_client: poll");
+			break;
+			}
+
+		if (fds[1].revents != 0)
+			{
+			size = read(STDIN_FILENO, input, sizeof(input));
+			if (size < 0 && errno != EINTR)
+				{
+				perror("Error in serve_client: read");
+				break;
+				}
+			if (size == 0)
+				{
+				// The server closes the connection after the last reply
+				input_eof = true;
+				shutdown(fd, SHUT_WR);
+				}
+			else if (size > 0)
+				{
+				input_start = 0;
+				input_length = (size_t)size;
+				}
+			}
+		if (fds[0].revents & POLLOUT)
+			{
+			size = send(fd, input + input_start, input_length - input_start,
+				MSG_NOSIGNAL);
+			if (size < 0 && errno != EAGAIN && errno != EINTR)
+				{
+				perror("Error in serve_client: send");
+				break;
+				}
+			if (size > 0)
+				input_start += (size_t)size;
+			}
+		if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
+			{
+			size = read(fd, output, sizeof(output));
+			if (size < 0 && errno != EAGAIN && errno != EINTR)
+				{
+				perror("Error in serve_client: read");
+				break;
+				}
+			if (size == 0)
+				{
+				ret = input_eof ? 0 : 1;
+				if (ret != 0)
+					fprintf(stderr, "Error in serve_client: connection closed "
+						"by the server\n");
+				break;
+				}
+			if (size > 0 && write_all(STDOUT_FILENO, output, (size_t)size) != 0)
+				{
+				perror("Error in serve_client: write");
+				break;
+				}
+			}
+		}
+	close(fd);
+	return ret;
+	}
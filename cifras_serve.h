@@ -0,0 +1,50 @@
+#ifndef CIFRAS_SERVE_H
+#define CIFRAS_SERVE_H
+
+#include "cifras_batch.h"
+
+// Server mode: a long-running process which solves the games sent by many
+// concurrent clients over a Unix stream socket, so they do not pay the
+// start-up of one process per game.
+//
+// Line-based protocol, the same as the batch mode (see batch_run): every
+// request is a line with a game and every reply is its output line. Replies
+// are sent in the order of the requests of the connection, even though the
+// games are solved in parallel, so a client may send many requests without
+// waiting for the replies. Blank lines are skipped and lines longer than
+// SERVE_MAX_LINE are answered with an error. The request line
+// stats
+// is answered with the counters of the server:
+// stats connections=<n> queued=<n> max_queued=<n> in_flight=<n>
+// requests=<n> errors=<n> latency_avg_us=<x> latency_p99_us=<x>
+// latency_max_us=<x> [cache_hits=<n> cache_misses=<n> cache_evictions=<n>]
+// where queued is the games waiting for a worker (max_queued its maximum so
+// far), in_flight the games waiting or being solved and the latency goes
+// from the reception of a game to its solution (p99 rounded up to a power of
+// 2, but never above the maximum). The counters of the cache are added if
+// the server has one.
+//
+// A connection is closed once the client closes its writing side
+// (shutdown(SHUT_WR)) and every reply has been sent.
+
+#define SERVE_MAX_LINE 1024
+
+// Serve on socket_path until SIGINT or SIGTERM. A previous socket left at
+// socket_path is replaced. Games are parsed and solved as config says, by a
+// fixed pool of nthreads worker threads (nthreads <= 0 means one per online
+// CPU). The counters are written to stderr on exit.
+// Return values:
+// 0: stopped by a signal
+// 1: error
+int serve_run(const char* socket_path, int nthreads,
+	const BatchConfig* config);
+
+// Small client of serve_run: send the lines of stdin to the server at
+// socket_path and write its replies to stdout, pipelined. For example:
+// cifras --client /tmp/cifras.sock < games.txt
+// Return values:
+// 0: every reply received
+// 1: error
+int serve_client(const char* socket_path);
+
+#endif
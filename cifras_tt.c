@@ -0,0 +1,132 @@
+#include "cifras_tt.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct
+	{
+	// Search which wrote the entry. Entries of older searches are free
+	uint32_t search;
+	int32_t numbers_count;
+	long int numbers[MAX_NUM_COUNT];
+	} TranspositionEntry;
+
+struct TranspositionTable
+	{
+	TranspositionEntry* entries;
+	uint64_t mask;
+	int size_bits;
+	uint32_t search;
+	TranspositionStats stats;
+	};
+
+TranspositionTable* transposition_table_create(int size_bits)
+	{
+	TranspositionTable* tt;
+
+	assert(size_bits > 0 && size_bits < 32);
+
+	tt = malloc(sizeof(TranspositionTable));
+	if (tt == NULL)
+		return NULL;
+	// calloc: search 0 is never used, so every entry starts free
+	tt->entries = calloc((size_t)1 << size_bits, sizeof(TranspositionEntry));
+	if (tt->entries == NULL)
+		{
+		free(tt);
+		return NULL;
+		}
+	tt->mask = ((uint64_t)1 << size_bits) - 1;
+	tt->size_bits = size_bits;
+	tt->search = 0;
+	tt->stats = (TranspositionStats){0, 0, 0, 0};
+	return tt;
+	}
+
+void transposition_table_destroy(TranspositionTable* tt)
+	{
+	if (tt == NULL)
+		return;
+	free(tt->entries);
+	free(tt);
+	}
+
+void transposition_table_new_search(TranspositionTable* tt)
+	{
+	size_t i;
+
+	assert(tt != NULL);
+	tt->search++;
+	// After 2^32 searches the old entries would look current again
+	if (tt->search == 0)
+		{
+		for (i = 0; i <= tt->mask; i++)
+			tt->entries[i].search = 0;
+		tt->search = 1;
+		}
+	}
+
+bool transposition_table_visit(TranspositionTable* tt, const long int* numbers,
+	int numbers_count)
+	{
+	long int sorted[MAX_NUM_COUNT];
+	TranspositionEntry* entry;
+	uint64_t hash;
+	int i, j;
+
+	assert(tt != NULL);
+	assert(numbers != NULL);
+	assert(numbers_count > 0 && numbers_count <= MAX_NUM_COUNT);
+
+	// Canonical form: insertion sort of the multiset
+	for (i = 0; i < numbers_count; i++)
+		{
+		for (j = i; j > 0 && sorted[j - 1] > numbers[i]; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = numbers[i];
+		}
+
+	hash = (uint64_t)numbers_count;
+	for (i = 0; i < numbers_count; i++)
+		{
+		hash = (hash ^ (uint64_t)sorted[i]) * 0x9E3779B97F4A7C15ULL;
+		hash ^= hash >> 29;
+		}
+	entry = &tt->entries[(hash >> (64 - tt->size_bits)) & tt->mask];
+
+	if (entry->search == tt->search && entry->numbers_count == numbers_count)
+		{
+		for (i = 0; i < numbers_count && entry->numbers[i] == sorted[i]; i++)
+			;
+		if (i == numbers_count)
+			{
+			tt->stats.hits++;
+			return true;
+			}
+		}
+
+	tt->stats.misses++;
+	if (entry->search == tt->search)
+		tt->stats.replacements++;
+	entry->search = tt->search;
+	entry->numbers_count = numbers_count;
+	for (i = 0; i < numbers_count; i++)
+		entry->numbers[i] = sorted[i];
+	return false;
+	}
+
+void transposition_table_count_node(TranspositionTable* tt)
+	{
+	assert(tt != NULL);
+	tt->stats.nodes++;
+	}
+
+void transposition_table_stats(const TranspositionTable* tt,
+	TranspositionStats* stats)
+	{
+	assert(tt != NULL);
+	assert(stats != NULL);
+	*stats = tt->stats;
+	}
@@ -0,0 +1,64 @@
+#ifndef CIFRAS_TT_H
+#define CIFRAS_TT_H
+
+#include "cifras_bt.h"
+
+#include <stdbool.h>
+
+// Transposition table for cifras_bt.
+//
+// The same multiset of pending numbers is reached many times through
+// different orders of the same operations, e.g. (a + b then c * d) and
+// (c * d then a + b). Two nodes with the same multiset at the same depth
+// have identical subtrees, so every solution below the second one has the
+// same result and steps count as one already considered below the first one:
+// it can never be better than best_steps (at most equal) and the second
+// subtree is cut.
+//
+// The table is fixed-size with one entry per slot (the newest state replaces
+// the previous one). Every entry stores the whole sorted multiset, so hash
+// collisions never cause a wrong cut. A table must not be shared by several
+// searches running at the same time.
+
+// Only nodes with at least this many numbers are stored. Smaller subtrees
+// are cheaper to explore than to look up
+#define TT_MIN_NUMBERS 3
+
+typedef struct TranspositionTable TranspositionTable;
+
+typedef struct
+	{
+	// Nodes visited by cifras_bt
+	unsigned long long nodes;
+	// Lookups of an already explored state (every hit cuts a subtree)
+	unsigned long long hits;
+	// Lookups of a new state
+	unsigned long long misses;
+	// Misses which overwrote an entry of another state of the same search
+	unsigned long long replacements;
+	} TranspositionStats;
+
+// 2^size_bits entries. Return NULL if out of memory
+TranspositionTable* transposition_table_create(int size_bits);
+void transposition_table_destroy(TranspositionTable* tt);
+
+// Forget the states of the previous search. O(1)
+void transposition_table_new_search(TranspositionTable* tt);
+
+// Return true if the state (numbers, numbers_count) has been already visited
+// in the current search. Otherwise record it and return false
+bool transposition_table_visit(TranspositionTable* tt, const long int* numbers,
+	int numbers_count);
+
+void transposition_table_count_node(TranspositionTable* tt);
+
+// Counters accumulated since the creation of the table
+void transposition_table_stats(const TranspositionTable* tt,
+	TranspositionStats* stats);
+
+// resolve_cifras using tt to cut repeated states. Same result as
+// resolve_cifras
+void resolve_cifras_tt(const long int* numbers, int target,
+	SolutionStepStack* best_steps, TranspositionTable* tt);
+
+#endif
@@ -1,4 +1,10 @@
+#include "cifras_batch.h"
 #include "cifras_bt.h"
+#include "cifras_cache.h"
+#include "cifras_db.h"
+#include "cifras_gen.h"
+#include "cifras_parse.h"
+#include "cifras_serve.h"
 
 #include <ctype.h>
 #include <regex.h>
@@ -10,49 +16,14 @@
 #include <unistd.h>
 
 #define EXIT_CHAR 'q'
-// Probability (percentage) that a big number shows up in a random numbers array
-#define RANDOM_BIG_NUMBER_PROBABILITY 28
-#define MIN_NUMBER 1
-#define MAX_NUMBER 100
-#define MIN_TARGET 100
-#define MAX_TARGET 999
-static const long int RANDOM_BIG_NUMBERS[] = {10, 25, 50, 100};
 
-static const size_t RANDOM_BIG_NUMBERS_COUNT = sizeof(RANDOM_BIG_NUMBERS) / sizeof(RANDOM_BIG_NUMBERS[0]);
-
-
-static int random_natural(int min_val, int max_val) 
-	{
-	if (min_val > max_val) {
-		fprintf(stderr, "Error in random_natural: min_val cannot be greater than max_val\n");
-		// Returning min_val as a fallback
-		return -1;
-	}
-
-	// 1. Calculate the size of the range
-	int range_length = (max_val - min_val) + 1;
-
-	// 2. Get random number, apply modulo, and shift by min_val
-	// (rand() % range_length) -> gives a number from 0 to (range_length - 1)
-	// ... + min_val         -> shifts the range to [min_val, max_val]
-	return (rand() % range_length) + min_val;
-	}
-
-static void generate_numbers(long int* numbers)
-	{
-	int probability, i, big_number_pos;
-	for (i = 0; i < NUM_COUNT; i++)
-		{
-		probability = random_natural(0, 100);
-		if (probability <= RANDOM_BIG_NUMBER_PROBABILITY)
-			{
-			big_number_pos = random_natural(0, RANDOM_BIG_NUMBERS_COUNT - 1);
-			numbers[i] = RANDOM_BIG_NUMBERS[big_number_pos];
-			}
-		else
-			numbers[i] = (long int)random_natural(1, 9);
-		}
-	}
+// State of the random games of the interactive mode
+static uint64_t random_state;
+// Largest number and target range of the games typed in interactive mode
+// (wider with --wide)
+static long int max_number = MAX_NUMBER;
+static int min_target = MIN_TARGET;
+static int max_target = MAX_TARGET;
 
 static void numbers_print(long int* numbers)
 	{
@@ -68,22 +39,25 @@ static void numbers_print(long int* numbers)
 	printf("\n");
 	}
 
-// stack is not const because there are push and pop operations
-static void steps_stack_print(SolutionStepStack* stack)
+// Steps from the first to the last one. stdout is buffered, so they are
+// written at once by the next flush
+static void steps_stack_print(const SolutionStepStack* stack)
 	{
-	SolutionStep step;
-	if (steps_stack_is_empty(stack) == false)
+	const SolutionStep* step;
+	int i;
+
+	for (i = 0; i < steps_stack_count(stack); i++)
 		{
-		steps_stack_pop(stack, &step);
-		steps_stack_print(stack);
-		printf("%ld %c %ld = %ld\n", step.a, step.op, step.b, step.result);
-		steps_stack_push(stack, &step);
+		step = &stack->steps[i];
+		printf("%ld %c %ld = %ld\n", step->a, step->op, step->b, step->result);
 		}
 	}
 
 static int get_user_input(char* buffer, size_t buffer_size, const char* prompt)
 	{
 	printf("%s", prompt);
+	// The prompt may not end with a new-line
+	fflush(stdout);
 	
 	if (fgets(buffer, buffer_size, stdin) == NULL)
 		{
@@ -94,27 +68,39 @@ static int get_user_input(char* buffer, size_t buffer_size, const char* prompt)
 	return 0;
 	}
 	
+// A regular expression compiled by the first validate_string call that uses
+// it. It is kept until the process exits
+typedef struct
+	{
+	regex_t regex;
+	bool compiled;
+	} CompiledRegex;
+
 // Return values:
 // 0: regex validated
 // 1: regex not validated
 // -1 error
-static int validate_string(const char* input, const char* regex_pattern)
+static int validate_string(const char* input, const char* regex_pattern,
+	CompiledRegex* compiled)
 	{
-	regex_t regex;
 	int ok;
 	char buffer[256];
 
 	// Compile regex
-	ok = regcomp(&regex, regex_pattern, REG_EXTENDED);
-	if (ok != 0)
+	if (compiled->compiled == false)
 		{
-		regerror(ok, &regex, buffer, sizeof(buffer));
-		fprintf(stderr, "Error in validate_string: regex compile error: %s\n", buffer);
-		return -1;
+		ok = regcomp(&compiled->regex, regex_pattern, REG_EXTENDED);
+		if (ok != 0)
+			{
+			regerror(ok, &compiled->regex, buffer, sizeof(buffer));
+			fprintf(stderr, "Error in validate_string: regex compile error: %s\n", buffer);
+			return -1;
+			}
+		compiled->compiled = true;
 		}
 	
 	// Execute regex validation
-	ok = regexec(&regex, input, 0, NULL, 0);
+	ok = regexec(&compiled->regex, input, 0, NULL, 0);
 	// If ok == 0, do nothing
 	if (ok == REG_NOMATCH)
 		ok = 1;
@@ -124,34 +110,70 @@ static int validate_string(const char* input, const char* regex_pattern)
 		ok = -1;
 		}
 	
-	// Free memory of the compiled regex
-	regfree(&regex);
-	
 	// Return value depending on the previous regex validation
 	return ok;
 	}
+
+// Validate count strictly positive values in input with cifras_parse_values.
+// Values too long for it go through regex_pattern (compiled once) and atol,
+// so they are still reported as out of range.
+// Return values:
+// 0: validated, values filled
+// 1: not validated
+// -1: error
+// input will be modified by the function strtok in the latter case
+static int validate_values(long int* values, int count, char* input,
+	const char* regex_pattern, CompiledRegex* compiled)
+	{
+	char* token;
+	int ok, parsed, i;
+	
+	ok = cifras_parse_values(input, input + strlen(input), values, count,
+		&parsed);
+	if (ok == 0)
+		{
+		if (parsed != count)
+			return 1;
+		for (i = 0; i < count; i++)
+			if (values[i] == 0)
+				return 1;
+		return 0;
+		}
+	if (ok == 1)
+		return 1;
 	
+	ok = validate_string(input, regex_pattern, compiled);
+	if (ok != 0)
+		return ok;
+	i = 0;
+	for (token = strtok(input, ", "); token != NULL && i < count;
+		token = strtok(NULL, ", "))
+		values[i++] = atol(token);
+	return i == count && token == NULL ? 0 : -1;
+	}
+
 // numbers_input will be modified by the function strtok.
 // In case it is wanted to reuse the string there, make a previous copy
 static int parse_numbers(long int* numbers, char* numbers_input)
 	{
-	char* token;
+	static CompiledRegex numbers_regex;
 	int ok;
-	int i = 0;
+	int i;
 	char regex_pattern[128];
 	
 	// Remove final new-line character
 	numbers_input[strcspn(numbers_input, "\n")] = 0;
 
 	// Validate numbers string
-	// Generate pattern dynamically taking into account the constant NUM_COUNT
-	// Alternative regex to allow several commas (besides spaces)
-	// between numbers:
+	// Pattern of the fallback of validate_values, generated dynamically
+	// taking into account the constant NUM_COUNT. Alternative regex to allow
+	// several commas (besides spaces) between numbers:
 	// ^[[:space:]]*(0*[1-9][0-9]*([[:space:]]|,)+){%d}0*[1-9][0-9]*[[:space:]]*$
 	snprintf(regex_pattern, sizeof(regex_pattern),
 		"^[[:space:]]*(0*[1-9][0-9]*([[:space:]]+|([[:space:]]*,[[:space:]]*))){%d}0*[1-9][0-9]*[[:space:]]*$",
 		NUM_COUNT - 1);
-	ok = validate_string(numbers_input, regex_pattern);
+	ok = validate_values(numbers, NUM_COUNT, numbers_input, regex_pattern,
+		&numbers_regex);
 	if (ok == 1)
 		{
 		fprintf(stderr, "Error in parse_numbers: input not validated. ");
@@ -165,11 +187,8 @@ static int parse_numbers(long int* numbers, char* numbers_input)
 		return -1;
 		}
 
-	// Add numbers into the array
-	token = strtok(numbers_input, ", ");
-	do
+	for (i = 0; i < NUM_COUNT; i++)
 		{
-		numbers[i] = atol(token);
 		if (numbers[i] <= 0)
 			{
 			fprintf(stderr, "Error in parse_numbers: ");
@@ -177,23 +196,13 @@ static int parse_numbers(long int* numbers, char* numbers_input)
 				numbers[i]);
 			return 1;
 			}
-		if (numbers[i] < MIN_NUMBER || numbers[i] > MAX_NUMBER)
+		if (numbers[i] < MIN_NUMBER || numbers[i] > max_number)
 			{
 			fprintf(stderr, "Error in parse_numbers: ");
-			fprintf(stderr, "number %ld is not between %d and %d\n",
-				numbers[i], MIN_NUMBER, MAX_NUMBER);
+			fprintf(stderr, "number %ld is not between %d and %ld\n",
+				numbers[i], MIN_NUMBER, max_number);
 			return 1;
 			}
-		token = strtok(NULL, " ,");
-		i++;
-		}
-	while (token != NULL && i < NUM_COUNT);
-	
-	if (i != NUM_COUNT)
-		{
-		fprintf(stderr, "Error in parse_numbers: %d numbers parsed instead of %d\n",
-			i, NUM_COUNT - 1);
-		return -1;
 		}
 	return 0;
 	}
@@ -202,14 +211,16 @@ static int parse_numbers(long int* numbers, char* numbers_input)
 // In case it is wanted to reuse the string there, make a previous copy
 static int parse_target(int* target, char* target_input)
 	{
-	char* token;
+	static CompiledRegex target_regex;
+	long int value;
 	int ok;
 
 	// Remove final new-line character
 	target_input[strcspn(target_input, "\n")] = 0;
      
 	// Validate
-	ok = validate_string(target_input, "^[[:space:]]*0*[1-9][0-9]*[[:space:]]*$");
+	ok = validate_values(&value, 1, target_input,
+		"^[[:space:]]*0*[1-9][0-9]*[[:space:]]*$", &target_regex);
 	if (ok == 1)
 		{
 		fprintf(stderr, "Error in parse_target: input not validated. ");
@@ -223,17 +234,11 @@ static int parse_target(int* target, char* target_input)
 		}
 	
 	// Capture target number
-	token = strtok(target_input, " ");
-	*target = atoi(token);
-	if (strtok(NULL, " ") != NULL)
-		{
-		fprintf(stderr, "Error in parse_target: target must be a single number\n");
-		return -1;
-		}
-	if (*target < MIN_TARGET || *target > MAX_TARGET)
+	*target = (int)value;
+	if (*target < min_target || *target > max_target)
 		{
 		fprintf(stderr, "Error in parse_target: target %d is not between %d and %d\n",
-			*target, MIN_TARGET, MAX_TARGET);
+			*target, min_target, max_target);
 		return 1;
 		}
 
@@ -320,8 +325,9 @@ static int get_user_data(long int* numbers, int* target)
 		if (ok != 0) return 1;
 		if (strcmp(buffer, "\n") == 0)
 			{
-			generate_numbers(numbers);
-			*target = random_natural(MIN_TARGET, MAX_TARGET);
+			cifras_random_numbers(&random_state, numbers);
+			*target = cifras_random_natural(&random_state, MIN_TARGET,
+				MAX_TARGET);
 			return 0;
 			}
 		ok = parse_numbers(numbers, buffer);
@@ -368,6 +374,7 @@ static void ask_user_to_continue(char exit_char)
 
 	printf("\nPress \"%c\" to exit or any other key to play again...",
 		upper_exit_char);
+	fflush(stdout);
 	input_char = get_char();
 	printf("\n");
 	if (input_char == '\0')
@@ -377,8 +384,7 @@ static void ask_user_to_continue(char exit_char)
 	else
 		printf("\n\n");
 	}
-// steps_stack is not const because it is called by steps_stack_print
-static void print_result(int target, SolutionStepStack* steps_stack)
+static void print_result(int target, const SolutionStepStack* steps_stack)
 	{
 	long int result = steps_stack_result(steps_stack);
 	printf("Result obtained: %ld", result);
@@ -390,18 +396,226 @@ static void print_result(int target, SolutionStepStack* steps_stack)
 	steps_stack_print(steps_stack);
 	}
 
-int main()
+static void print_cache_stats(CifrasCache* cache)
+	{
+	CifrasCacheStats stats;
+
+	cifras_cache_stats(cache, &stats);
+	fprintf(stderr, "cache hits=%llu misses=%llu insertions=%llu "
+		"evictions=%llu\n", stats.hits, stats.misses, stats.insertions,
+		stats.evictions);
+	}
+
+static void print_usage(const char* program)
+	{
+	fprintf(stderr, "Usage: %s [--batch FILE|-] [--threads N] [--db FILE] "
+		"[--cache N] [--engine " CIFRAS_ENGINE_NAMES "] [--wide]\n", program);
+	fprintf(stderr, "       %s --serve SOCKET [--threads N] [--db FILE] "
+		"[--cache N] [--engine " CIFRAS_ENGINE_NAMES "] [--wide]\n", program);
+	fprintf(stderr, "       %s --client SOCKET\n", program);
+	fprintf(stderr, "       %s --generate N [--seed S] [--solvable|--unsolvable] "
+		"[--min-steps N] [--max-steps N] [--threads N]\n", program);
+	}
+
+// Value of the option argv[i] (argv[i + 1]), at least min_val.
+// Return values:
+// 0: value parsed
+// 1: wrong value
+static int parse_option_value(char** argv, int i, long long min_val,
+	long long* value)
+	{
+	char* end;
+
+	*value = strtoll(argv[i + 1], &end, 10);
+	if (*end != '\0' || end == argv[i + 1] || *value < min_val)
+		{
+		fprintf(stderr, "Error in parse_arguments: ");
+		fprintf(stderr, "wrong value of %s %s\n", argv[i], argv[i + 1]);
+		return 1;
+		}
+	return 0;
+	}
+
+// Return values:
+// 0: arguments parsed
+// 1: wrong arguments
+// generate_count: puzzles of the generator mode or -1 if not used
+// serve_path/client_path: socket of the server/client mode or NULL
+// cache_size: entries of the cache of solutions or 0 if not used
+// wide: games with the ranges of WIDE_MAX_NUMBER and WIDE_MAX_TARGET
+static int parse_arguments(int argc, char** argv, const char** batch_input,
+	const char** serve_path, const char** client_path, int* nthreads,
+	const char** db_path, long long* cache_size, CifrasEngine* engine,
+	bool* wide, long long* generate_count, CifrasGenConstraints* constraints,
+	long long* seed)
+	{
+	long long value;
+	int i;
+	char* end;
+
+	*batch_input = NULL;
+	*serve_path = NULL;
+	*client_path = NULL;
+	*nthreads = 0;
+	*db_path = NULL;
+	*cache_size = 0;
+	*engine = CIFRAS_ENGINE_BT;
+	*wide = false;
+	*generate_count = -1;
+	*constraints = (CifrasGenConstraints){CIFRAS_GEN_ANY, 0, 0};
+	*seed = (long long)time(NULL);
+	for (i = 1; i < argc; i++)
+		{
+		if (strcmp(argv[i], "--generate") == 0 && i + 1 < argc)
+			{
+			if (parse_option_value(argv, i++, 0, generate_count) != 0)
+				return 1;
+			}
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+			{
+			if (parse_option_value(argv, i++, 0, seed) != 0)
+				return 1;
+			}
+		else if (strcmp(argv[i], "--min-steps") == 0 && i + 1 < argc)
+			{
+			if (parse_option_value(argv, i++, 0, &value) != 0)
+				return 1;
+			constraints->min_steps = value > NUM_COUNT ? NUM_COUNT : (int)value;
+			}
+		else if (strcmp(argv[i], "--max-steps") == 0 && i + 1 < argc)
+			{
+			if (parse_option_value(argv, i++, 1, &value) != 0)
+				return 1;
+			constraints->max_steps = value > NUM_COUNT ? NUM_COUNT : (int)value;
+			}
+		else if (strcmp(argv[i], "--solvable") == 0)
+			constraints->solvable = CIFRAS_GEN_SOLVABLE;
+		else if (strcmp(argv[i], "--unsolvable") == 0)
+			constraints->solvable = CIFRAS_GEN_UNSOLVABLE;
+		else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+			*batch_input = argv[++i];
+		else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+			*serve_path = argv[++i];
+		else if (strcmp(argv[i], "--client") == 0 && i + 1 < argc)
+			*client_path = argv[++i];
+		else if (strcmp(argv[i], "--db") == 0 && i + 1 < argc)
+			*db_path = argv[++i];
+		else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+			{
+			if (parse_option_value(argv, i++, 1, cache_size) != 0)
+				return 1;
+			}
+		else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc &&
+			cifras_engine_from_name(argv[i + 1], engine))
+			i++;
+		else if (strcmp(argv[i], "--wide") == 0)
+			*wide = true;
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			{
+			*nthreads = (int)strtol(argv[++i], &end, 10);
+			if (*end != '\0' || *nthreads <= 0)
+				{
+				fprintf(stderr, "Error in parse_arguments: ");
+				fprintf(stderr, "wrong number of threads %s\n", argv[i]);
+				return 1;
+				}
+			}
+		else
+			{
+			print_usage(argv[0]);
+			return 1;
+			}
+		}
+	return 0;
+	}
+
+int main(int argc, char** argv)
 	{
 	long int numbers[NUM_COUNT];
 	int target;
 	SolutionStepStack steps_stack;
 	int ok;
-
-	// Disabling buffer to allow printing lines without new-line character at the end
-	setbuf(stdout, NULL);
+	const char* batch_input;
+	const char* serve_path;
+	const char* client_path;
+	const char* db_path;
+	int nthreads;
+	CifrasEngine engine;
+	bool wide;
+	BatchConfig config;
+	CifrasDb db = {0};
+	CifrasCache cache;
+	long long cache_size;
+	long long generate_count, seed;
+	CifrasGenConstraints constraints;
+
+	ok = parse_arguments(argc, argv, &batch_input, &serve_path, &client_path,
+		&nthreads, &db_path, &cache_size, &engine, &wide, &generate_count,
+		&constraints, &seed);
+	if (ok != 0) return 1;
 	
-	// Initialize the rand function with a seed
-	srand(time(NULL));
+	// Client of the server mode
+	if (client_path != NULL)
+		return serve_client(client_path);
+	
+	// Generator mode
+	if (generate_count >= 0)
+		return cifras_gen_run(&constraints, (size_t)generate_count,
+			(uint64_t)seed, stdout, nthreads);
+	
+	// Precomputed solutions. Games out of the db are solved anyway
+	if (db_path != NULL)
+		{
+		ok = cifras_db_open(&db, db_path);
+		if (ok != 0) return 1;
+		}
+	
+	// Cache of solutions of the batch and server modes
+	if (cache_size > 0 && (serve_path != NULL || batch_input != NULL))
+		{
+		if (cifras_cache_init(&cache, (size_t)cache_size) != 0)
+			{
+			fprintf(stderr, "Error in main: out of memory for the cache\n");
+			return 1;
+			}
+		}
+	
+	config = (BatchConfig){db_path != NULL ? &db : NULL,
+		cache_size > 0 ? &cache : NULL, engine, wide};
+	
+	// Server mode
+	if (serve_path != NULL)
+		{
+		ok = serve_run(serve_path, nthreads, &config);
+		if (db_path != NULL)
+			cifras_db_close(&db);
+		if (cache_size > 0)
+			cifras_cache_free(&cache);
+		return ok;
+		}
+	
+	// Non-interactive mode
+	if (batch_input != NULL)
+		{
+		ok = batch_run(batch_input, stdout, nthreads, &config);
+		if (db_path != NULL)
+			cifras_db_close(&db);
+		if (cache_size > 0)
+			{
+			print_cache_stats(&cache);
+			cifras_cache_free(&cache);
+			}
+		return ok;
+		}
+
+	// Seed the random games
+	cifras_random_seed(&random_state, (uint64_t)time(NULL));
+	if (wide)
+		{
+		max_number = WIDE_MAX_NUMBER;
+		min_target = WIDE_MIN_TARGET;
+		max_target = WIDE_MAX_TARGET;
+		}
 	
 	for (;;)
 		{
@@ -415,7 +629,16 @@ int main()
 		printf("Target: %d\n\n", target);
 	
 		// Resolve game
-		resolve_cifras(numbers, target, &steps_stack);
+		if (db_path == NULL ||
+			cifras_db_lookup(&db, numbers, target, &steps_stack) == false)
+			{
+			// Only the bt engine is split among threads
+			if (engine != CIFRAS_ENGINE_BT)
+				resolve_cifras_engine(numbers, NUM_COUNT, target, &steps_stack,
+					engine);
+			else
+				resolve_cifras_mt(numbers, target, &steps_stack, nthreads);
+			}
 		
 		// Print result
 		print_result(target, &steps_stack);
@@ -0,0 +1,161 @@
+#include "work_pool.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define CACHE_LINE_SIZE 64
+
+// Pending indexes of one worker: [next, end).
+// Aligned to the cache line so that the atomic increments of one worker do
+// not invalidate the range of its neighbours
+typedef struct
+	{
+	_Alignas(CACHE_LINE_SIZE) atomic_size_t next;
+	size_t end;
+	} WorkPoolRange;
+
+typedef struct
+	{
+	WorkPoolRange* ranges;
+	int workers;
+	WorkPoolTaskFn task_fn;
+	void* arg;
+	} WorkPool;
+
+typedef struct
+	{
+	WorkPool* pool;
+	int worker_id;
+	} WorkPoolWorker;
+
+int work_pool_default_threads(void)
+	{
+	long int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus > 0 ? (int)cpus : 1;
+	}
+
+// Claim one index of the range. The counter may go beyond end when several
+// workers race for the last index, which is harmless
+static inline bool range_claim(WorkPoolRange* range, size_t* task_index)
+	{
+	size_t i;
+
+	// Cheap check first to avoid dirtying the cache line of exhausted ranges
+	if (atomic_load_explicit(&range->next, memory_order_relaxed) >= range->end)
+		return false;
+	i = atomic_fetch_add_explicit(&range->next, 1, memory_order_relaxed);
+	if (i >= range->end)
+		return false;
+	*task_index = i;
+	return true;
+	}
+
+static void* worker_run(void* arg)
+	{
+	WorkPoolWorker* worker = arg;
+	WorkPool* pool = worker->pool;
+	size_t task_index;
+	int victim, i;
+	bool found;
+
+	// 1. Own range
+	while (range_claim(&pool->ranges[worker->worker_id], &task_index))
+		pool->task_fn(pool->arg, task_index, worker->worker_id);
+
+	// 2. Steal from the rest of the workers, starting from the next one so
+	// that the thieves spread over different victims
+	do
+		{
+		found = false;
+		for (i = 1; i < pool->workers; i++)
+			{
+			victim = (worker->worker_id + i) % pool->workers;
+			while (range_claim(&pool->ranges[victim], &task_index))
+				{
+				pool->task_fn(pool->arg, task_index, worker->worker_id);
+				found = true;
+				}
+			}
+		}
+	while (found);
+
+	return NULL;
+	}
+
+int work_pool_run(size_t task_count, int nthreads, WorkPoolTaskFn task_fn,
+	void* arg)
+	{
+	WorkPool pool;
+	WorkPoolWorker* workers;
+	pthread_t* threads;
+	size_t chunk, start;
+	int i, created, ok;
+
+	assert(task_fn != NULL);
+
+	if (task_count == 0)
+		return 0;
+	if (nthreads <= 0)
+		nthreads = work_pool_default_threads();
+	if ((size_t)nthreads > task_count)
+		nthreads = (int)task_count;
+
+	pool.ranges = aligned_alloc(CACHE_LINE_SIZE,
+		sizeof(WorkPoolRange) * nthreads);
+	workers = malloc(sizeof(WorkPoolWorker) * nthreads);
+	threads = malloc(sizeof(pthread_t) * nthreads);
+	if (pool.ranges == NULL || workers == NULL || threads == NULL)
+		{
+		fprintf(stderr, "Error in work_pool_run: out of memory\n");
+		free(pool.ranges);
+		free(workers);
+		free(threads);
+		return -1;
+		}
+	pool.workers = nthreads;
+	pool.task_fn = task_fn;
+	pool.arg = arg;
+
+	// Distribute the indexes in contiguous ranges of (almost) equal size
+	chunk = task_count / nthreads;
+	start = 0;
+	for (i = 0; i < nthreads; i++)
+		{
+		atomic_init(&pool.ranges[i].next, start);
+		start += chunk + ((size_t)i < task_count % nthreads ? 1 : 0);
+		pool.ranges[i].end = start;
+		workers[i] = (WorkPoolWorker){&pool, i};
+		}
+	assert(start == task_count);
+
+	// Worker 0 is the calling thread
+	for (created = 1; created < nthreads; created++)
+		{
+		ok = pthread_create(&threads[created], NULL, worker_run,
+			&workers[created]);
+		if (ok != 0)
+			break;
+		}
+	if (created < nthreads)
+		{
+		// The threads already created can only run tasks of their own or
+		// stolen ones, so the remaining ones are run here. Report the error
+		// anyway because the caller asked for a given parallelism
+		fprintf(stderr, "Error in work_pool_run: pthread_create failed. ");
+		fprintf(stderr, "Running with %d threads\n", created);
+		}
+	worker_run(&workers[0]);
+
+	for (i = 1; i < created; i++)
+		pthread_join(threads[i], NULL);
+
+	free(pool.ranges);
+	free(workers);
+	free(threads);
+	return 0;
+	}
@@ -0,0 +1,31 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <stddef.h>
+
+// Fork-join pool with work stealing.
+//
+// work_pool_run splits the indexes 0..task_count-1 into one contiguous range
+// per worker. Every worker consumes its own range and, once it is exhausted,
+// steals the pending indexes of the other workers. Claiming an index is a
+// single atomic increment, so no locks are taken while running tasks.
+//
+// The calling thread works as worker 0 and the function returns when every
+// task has been run.
+
+// task_index: index of the task to run (0..task_count-1)
+// worker_id: index of the worker running it (0..workers-1). Useful to
+// address per-worker data without locking
+typedef void (*WorkPoolTaskFn)(void* arg, size_t task_index, int worker_id);
+
+// Number of workers used when the caller passes nthreads <= 0
+int work_pool_default_threads(void);
+
+// Return values:
+// 0: all tasks run
+// -1: out of memory (no task has been run)
+// If some thread cannot be created, the tasks are run with fewer workers
+int work_pool_run(size_t task_count, int nthreads, WorkPoolTaskFn task_fn,
+	void* arg);
+
+#endif